@@ -0,0 +1,203 @@
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <s3eDebug.h>
+#include <s3eTimer.h>
+
+#include <atomics.h>
+
+#include "audio/Adpcm.h"
+#include "audio/Buffer.h"
+#include "audio/Decoder.h"
+#include "audio/File.h"
+#include "audio/Resampler.h"
+#include "audio/Utils.h"
+
+using namespace audio;
+
+namespace {
+
+const int sampleRate = 22050;
+const size_t sampleFrames = sampleRate * 2;
+// Frames mixed per call, one typical callback.
+const int mixFrames = 0x200;
+const int repeats = 0x20;
+const int outputRate = 44100;
+// Resampler input per process call.
+const uint32_t resampleChunk = 0x100;
+// Volume applied by decode, so the int16 pipeline runs its volume pass.
+const int decodeVolume = 0xc0;
+const int decodeRepeats = 4;
+// Largest resampler delay searched for when comparing with the ideal signal.
+const size_t maxDelay = 0x40;
+const double pi = 3.14159265358979323846;
+
+// Sum of two tones, so the signal is not trivially predictable.
+Buffer makeTone(size_t frames, int rate)
+{
+    Buffer result(frames * 2);
+    int16_t * data = reinterpret_cast<int16_t*>(result.data());
+    for(size_t i = 0; i != frames; ++i)
+        data[i] = static_cast<int16_t>(12000 * sin(2 * pi * 440 * i / rate) + 6000 * sin(2 * pi * 1870 * i / rate));
+    return result;
+}
+
+double snr(const int16_t * reference, const int16_t * test, size_t frames)
+{
+    double signal = 0;
+    double noise = 0;
+    for(size_t i = 0; i != frames; ++i)
+    {
+        double diff = test[i] - reference[i];
+        signal += static_cast<double>(reference[i]) * reference[i];
+        noise += diff * diff;
+    }
+    return noise ? 10 * log10(signal / noise) : 999;
+}
+
+// SNR of test against reference at the delay that fits best, resamplers
+// delay their output by a few frames.
+double delayedSnr(const int16_t * reference, const int16_t * test, size_t frames)
+{
+    double result = -999;
+    for(size_t delay = 0; delay != maxDelay; ++delay)
+        result = std::max(result, snr(reference + maxDelay, test + maxDelay + delay, frames - 2 * maxDelay));
+    return result;
+}
+
+void tone(int16_t * out, size_t frames, int rate)
+{
+    for(size_t i = 0; i != frames; ++i)
+        out[i] = static_cast<int16_t>(16000 * sin(2 * pi * 1000 * i / rate));
+}
+
+// Picoseconds per frame.
+int perFrame(uint64 ns, size_t frames)
+{
+    return static_cast<int>(ns * 1000 / frames);
+}
+
+// A PCM voice mixes like BufferSource at normal rate, through audio::mix.
+void benchAdpcm()
+{
+    Buffer pcm = makeTone(sampleFrames, sampleRate);
+    Buffer adpcm = encodeAdpcm(pcm);
+    int16_t * data = reinterpret_cast<int16_t*>(pcm.data());
+    int16_t out[mixFrames];
+
+    uint64 pcmNs = 0;
+    uint64 adpcmNs = 0;
+    for(int r = 0; r != repeats; ++r)
+    {
+        memset(out, 0, sizeof(out));
+        uint64 begin = s3eTimerGetUSTNanoseconds();
+        for(size_t offset = 0; offset < sampleFrames; offset += mixFrames)
+            mix(true, out, data + offset, 0x100, std::min<size_t>(mixFrames, sampleFrames - offset));
+        pcmNs += s3eTimerGetUSTNanoseconds() - begin;
+
+        AdpcmSource source(false, adpcm);
+        memset(out, 0, sizeof(out));
+        begin = s3eTimerGetUSTNanoseconds();
+        while(source.mix(out, mixFrames) > 0)
+            ;
+        adpcmNs += s3eTimerGetUSTNanoseconds() - begin;
+    }
+
+    std::vector<int16_t> decoded(sampleFrames);
+    AdpcmSource source(false, adpcm);
+    source.mix(&decoded[0], sampleFrames);
+
+    size_t frames = sampleFrames * repeats;
+    s3eDebugTracePrintf("adpcm: mix pcm %d ps/frame, adpcm %d ps/frame, size %d -> %d bytes, snr %d dB",
+                        perFrame(pcmNs, frames), perFrame(adpcmNs, frames),
+                        static_cast<int>(pcm.size()), static_cast<int>(adpcm.size()),
+                        static_cast<int>(snr(data, &decoded[0], sampleFrames)));
+}
+
+// Upsamples a tone the way SFX are converted at load, in chunks through
+// Resampler::process, and compares it with the tone generated at output rate.
+void benchResampler(ResamplerType type, const char * name)
+{
+    size_t outputFrames = sampleFrames * outputRate / sampleRate;
+    std::vector<int16_t> input(sampleFrames);
+    std::vector<int16_t> reference(outputFrames);
+    std::vector<int16_t> output(outputFrames);
+    tone(&input[0], sampleFrames, sampleRate);
+    tone(&reference[0], outputFrames, outputRate);
+
+    uint64 ns = 0;
+    size_t produced = 0;
+    for(int r = 0; r != repeats; ++r)
+    {
+        std::auto_ptr<Resampler> resampler(createResampler(type, sampleRate, outputRate));
+        size_t inPos = 0;
+        produced = 0;
+        uint64 begin = s3eTimerGetUSTNanoseconds();
+        while(inPos != sampleFrames && produced != outputFrames)
+        {
+            uint32_t inlen = std::min<uint32_t>(resampleChunk, sampleFrames - inPos);
+            uint32_t outlen = outputFrames - produced;
+            resampler->process(&input[inPos], inlen, &output[produced], outlen);
+            inPos += inlen;
+            produced += outlen;
+            if(!inlen && !outlen)
+                break;
+        }
+        ns += s3eTimerGetUSTNanoseconds() - begin;
+    }
+
+    int quality = produced > 2 * maxDelay ? static_cast<int>(delayedSnr(&reference[0], &output[0], produced)) : 0;
+    s3eDebugTracePrintf("resample %s %d -> %d: %d ps/output frame, snr %d dB",
+                        name, sampleRate, outputRate, perFrame(ns, outputFrames * repeats), quality);
+}
+
+// Decodes an Ogg asset through the int16 and the float pipeline of Decoder.
+// The difference between the results is reported as SNR of the int16 one.
+void benchDecode(const char * fname)
+{
+    Buffer data = loadFile(fname);
+    if(data.empty())
+    {
+        s3eDebugTracePrintf("decode: %s not found, skipped", fname);
+        return;
+    }
+
+    Buffer results[2];
+    uint64 ns[2];
+    for(int pipeline = 0; pipeline != 2; ++pipeline)
+    {
+        Decoder decoder(resamplerSpeex, pipeline != 0);
+        ns[pipeline] = 0;
+        for(int r = 0; r != decodeRepeats; ++r)
+        {
+            std::auto_ptr<File> file(openFile(data));
+            uint64 begin = s3eTimerGetUSTNanoseconds();
+            results[pipeline] = decoder.decode(*file, decodeVolume);
+            ns[pipeline] += s3eTimerGetUSTNanoseconds() - begin;
+        }
+    }
+
+    size_t frames = std::min(results[0].size(), results[1].size()) / 2;
+    int difference = frames ? static_cast<int>(snr(reinterpret_cast<int16_t*>(results[1].data()),
+                                                   reinterpret_cast<int16_t*>(results[0].data()), frames)) : 0;
+    s3eDebugTracePrintf("decode %s: int16 %d us, float %d us, %d frames, snr %d dB", fname,
+                        static_cast<int>(ns[0] / 1000 / decodeRepeats), static_cast<int>(ns[1] / 1000 / decodeRepeats),
+                        static_cast<int>(frames), difference);
+}
+
+}
+
+int main()
+{
+    atomicsGetTable(audio::atomics);
+    benchAdpcm();
+    benchResampler(resamplerSpeex, "speex");
+    benchResampler(resamplerLinear, "linear");
+    benchResampler(resamplerCubic, "cubic");
+    benchDecode("bench.ogg");
+    return 0;
+}
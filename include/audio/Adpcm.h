@@ -0,0 +1,36 @@
+#pragma once
+
+#include "audio/Buffer.h"
+#include "audio/Source.h"
+
+namespace audio {
+
+// Compresses 16 bit mono samples to 4 bit IMA-ADPCM blocks, about 4 times
+// smaller than source. Result should be played with AdpcmSource.
+Buffer encodeAdpcm(const Buffer & pcm, BufferAllocator & allocator = defaultBufferAllocator());
+
+// Plays buffer produced by encodeAdpcm, blocks are decoded straight into
+// the mix, nothing is decompressed in advance.
+class AdpcmSource : public Source {
+public:
+    AdpcmSource(bool owned, const Buffer & data);
+
+    // Allocated from a fixed pool.
+    static void * operator new(size_t size);
+    static void operator delete(void * data);
+
+    void volume(int value);
+
+    bool pollable() { return false; }
+    int mix(int16_t * out, int limit);
+    int position() const;
+private:
+    Buffer data_;
+    int frames_;
+    int pos_;
+    int predictor_;
+    int index_;
+    int volume_;
+};
+
+}
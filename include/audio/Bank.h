@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "audio/Buffer.h"
+
+namespace audio {
+
+class File;
+
+// Bank file keeps many assets in one file. Layout, all numbers little endian:
+//   "ABNK", uint32 version (1), uint32 count,
+//   count entries of uint32 hash, uint32 offset, uint32 length, uint16 codec,
+//   uint16 reserved, uint32 rate,
+//   asset data, offsets are from the start of the file and should be even.
+// hash is bankHash of the asset name.
+enum BankCodec {
+    bankPcm,    // 16 bit mono samples at rate
+    bankOgg,    // ogg vorbis stream
+    bankAdpcm   // encodeAdpcm output at output rate
+};
+
+struct BankEntry {
+    uint32_t hash;
+    BankCodec codec;
+    int rate;
+    // Slice of the bank buffer, nothing is copied.
+    Buffer data;
+};
+
+uint32_t bankHash(const char * name);
+
+class Bank {
+public:
+    Bank();
+    explicit Bank(const Buffer & data);
+
+    // Reads whole bank with one loadFile, returns false if it is not a valid bank.
+    bool load(const char * fname);
+    bool load(const Buffer & data);
+
+    size_t size() const { return entries_.size(); }
+    const BankEntry & entry(size_t index) const { return entries_[index]; }
+
+    const BankEntry * find(uint32_t hash) const;
+    const BankEntry * find(const char * name) const;
+    const BankEntry * find(const std::string & name) const;
+
+    // OggFile or RawFile over entry data, caller owns result. Returns 0 for adpcm
+    // entries, they are played with AdpcmSource.
+    static File * open(const BankEntry & entry);
+private:
+    Buffer data_;
+    std::vector<BankEntry> entries_;
+};
+
+}
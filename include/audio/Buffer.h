@@ -2,32 +2,51 @@
 
 #include <string.h>
 
+#include <algorithm>
+
 #include <atomics.h>
 
+// Payload alignment of every Buffer. Must be a power of two and large enough
+// to hold the header, 32 covers 128/256 bit vector loads, use 64 for cache lines.
+#ifndef AUDIO_BUFFER_ALIGNMENT
+#define AUDIO_BUFFER_ALIGNMENT 32
+#endif
+
 namespace audio {
 
 extern AtomicFunctions atomics;
 
+// Memory source for Buffer storage. allocate must return memory aligned to
+// Buffer::alignment, deallocate receives the same size that was allocated.
+// Allocator must outlive every Buffer created with it.
+class BufferAllocator {
+public:
+    virtual void * allocate(size_t size) = 0;
+    virtual void deallocate(void * data, size_t size) = 0;
+
+    virtual ~BufferAllocator() {}
+};
+
+BufferAllocator & defaultBufferAllocator();
+
 class Buffer {
 public:
+    static const size_t alignment = AUDIO_BUFFER_ALIGNMENT;
+
     Buffer()
-        : data_(0)
+        : header_(0), offset_(0), size_(0)
     {
     }
 
-    explicit Buffer(size_t size)
-        : data_(new char[size + 8])
+    explicit Buffer(size_t size, BufferAllocator & allocator = defaultBufferAllocator())
+        : header_(create(size, allocator)), offset_(0), size_(size)
     {
-        *sizeAddress() = size;
-        *counterAddress() = 1;
     }
 
-    Buffer(const char * data, size_t size)
-        : data_(new char[size + 8])
+    Buffer(const char * data, size_t size, BufferAllocator & allocator = defaultBufferAllocator())
+        : header_(create(size, allocator)), offset_(0), size_(size)
     {
         memcpy(this->data(), data, size);
-        *sizeAddress() = size;
-        *counterAddress() = 1;
     }
 
     ~Buffer()
@@ -36,51 +55,116 @@ public:
     }
 
     Buffer(const Buffer & rhs)
-        : data_(rhs.data_)
+        : header_(rhs.header_), offset_(rhs.offset_), size_(rhs.size_)
     {
-        if(data_)
-            atomics.add(counterAddress(), 1);
+        if(header_)
+            atomics.add(&header_->counter, 1);
     }
 
-    void operator=(const Buffer & rhs)
+    Buffer & operator=(const Buffer & rhs)
     {
+        if(rhs.header_)
+            atomics.add(&rhs.header_->counter, 1);
         reset();
-        data_ = rhs.data_;
-        if(data_)
-            atomics.add(counterAddress(), 1);
+        header_ = rhs.header_;
+        offset_ = rhs.offset_;
+        size_ = rhs.size_;
+        return *this;
+    }
+
+#if __cplusplus >= 201103L
+    Buffer(Buffer && rhs)
+        : header_(rhs.header_), offset_(rhs.offset_), size_(rhs.size_)
+    {
+        rhs.header_ = 0;
+        rhs.offset_ = rhs.size_ = 0;
+    }
+
+    Buffer & operator=(Buffer && rhs)
+    {
+        swap(rhs);
+        return *this;
+    }
+#endif
+
+    // Exchanges contents without touching reference counters, use it to hand
+    // a buffer over between owners.
+    void swap(Buffer & rhs)
+    {
+        Header * temp = header_;
+        header_ = rhs.header_;
+        rhs.header_ = temp;
+        std::swap(offset_, rhs.offset_);
+        std::swap(size_, rhs.size_);
+    }
+
+    // View of size bytes starting at offset, shares storage and counter with
+    // this buffer. Only whole buffers are guaranteed to be aligned.
+    Buffer slice(size_t offset, size_t size) const
+    {
+        Buffer result(*this);
+        result.offset_ += offset;
+        result.size_ = size;
+        return result;
     }
 
     size_t size() const
     {
-        return *sizeAddress();
+        return size_;
     }
 
     char * data() const
     {
-        return data_ + 8;
+        return header_ ? reinterpret_cast<char*>(header_) + headerSize + offset_ : 0;
+    }
+
+    bool empty() const
+    {
+        return header_ == 0;
     }
 
     void reset()
     {
-        if(data_)
+        if(header_)
         {
-            if(atomics.add(counterAddress(), -1) == 1)
-                delete [] data_;
-            data_ = 0;
+            if(atomics.add(&header_->counter, -1) == 1)
+                destroy(header_);
+            header_ = 0;
         }
+        offset_ = size_ = 0;
     }
 private:
-    size_t * sizeAddress() const
+    struct Header {
+        volatile int counter;
+        size_t size;
+        BufferAllocator * allocator;
+    };
+
+    static const size_t headerSize = alignment;
+    typedef char HeaderFitsAlignment[sizeof(Header) <= headerSize ? 1 : -1];
+
+    static Header * create(size_t size, BufferAllocator & allocator)
     {
-        return static_cast<size_t*>(static_cast<void*>(data_ + 4));
+        Header * result = static_cast<Header*>(allocator.allocate(size + headerSize));
+        result->counter = 1;
+        result->size = size;
+        result->allocator = &allocator;
+        return result;
     }
 
-    volatile int * counterAddress() const
+    static void destroy(Header * header)
     {
-        return static_cast<volatile int*>(static_cast<void*>(data_));
+        header->allocator->deallocate(header, header->size + headerSize);
     }
 
-    char * data_;
+    Header * header_;
+    size_t offset_;
+    size_t size_;
 };
 
+inline void swap(Buffer & lhs, Buffer & rhs)
+{
+    lhs.swap(rhs);
+}
+
 }
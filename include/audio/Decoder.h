@@ -1,19 +1,54 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
+#include "audio/Buffer.h"
+#include "audio/Resampler.h"
+
 namespace audio {
 
-class OggFile;
-class Buffer;
+class File;
 
 class Decoder {
 public:
-    Decoder();
+    // Float pipeline takes decoder output as floats, resamples them and
+    // quantizes once with volume applied, for files that support readFloat.
+    explicit Decoder(ResamplerType resampler = resamplerSpeex, bool floatPipeline = false);
     ~Decoder();
 
-    Buffer decode(OggFile & file, int volume = 0x100);
+    // Mono PCM files at output rate are not decoded, at unchanged volume the
+    // result shares storage with the file data and allocator is not used.
+    Buffer decode(File & file, int volume = 0x100, BufferAllocator & allocator = defaultBufferAllocator());
 private:
+    ResamplerType resampler_;
+    bool floatPipeline_;
     int16_t * decodeBuffer_;
     std::vector<int16_t> buffer_;
 };
 
+// Decodes a file in small portions, so large assets could be loaded while
+// the game is running. Call step() once per frame until it returns true.
+class DecodeJob {
+public:
+    typedef void (*Callback)(const Buffer & result, void * userData);
+
+    explicit DecodeJob(File & file, int volume = 0x100, BufferAllocator & allocator = defaultBufferAllocator(),
+                       ResamplerType resampler = resamplerSpeex, bool floatPipeline = false);
+    ~DecodeJob();
+
+    // Called from step() right after decoding is finished.
+    void onComplete(Callback callback, void * userData);
+
+    // Decodes for at most budgetUs microseconds (one decode portion is always
+    // processed), returns true when decoding is finished.
+    bool step(int budgetUs);
+    bool done() const;
+
+    const Buffer & result() const;
+private:
+    class Impl;
+    std::auto_ptr<Impl> impl_;
+};
+
 }
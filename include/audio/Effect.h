@@ -0,0 +1,134 @@
+#pragma once
+
+namespace audio {
+
+// Effects per voice or bus.
+const size_t maxEffects = 4;
+
+// Block processor inserted after Source::mix, see Manager::addEffect.
+// Called from audio thread with whole callback blocks of 16 bit samples,
+// interleaved when output is stereo.
+class Effect {
+public:
+    Effect()
+        : bypass_(0), silentFrames_(static_cast<size_t>(-1))
+    {
+    }
+
+    // Bypassed effect passes input through unchanged and costs nothing.
+    void bypass(bool value) { bypass_ = value; }
+    bool bypassed() const { return bypass_ != 0; }
+    // True if effect would not run for silent input.
+    bool idle() const { return bypass_ || silentFrames_ >= tail(); }
+
+    // Runs process unless bypassed or input is silent and previous output
+    // already died out. Silent data must be zeros. Returns false if data is
+    // silent on return.
+    bool run(int16_t * data, size_t frames, int channels, bool silent);
+
+    virtual ~Effect() {}
+protected:
+    // Processes frames in place, at most 2 channels.
+    virtual void process(int16_t * data, size_t frames, int channels) = 0;
+    // Frames of output produced after input goes silent.
+    virtual size_t tail() const = 0;
+    // Clears internal state, called once output died out.
+    virtual void reset() {}
+private:
+    volatile int bypass_;
+    size_t silentFrames_;
+};
+
+struct EffectChain {
+    Effect * effects[maxEffects];
+    size_t size;
+
+    // True if no effect would run for silent input.
+    bool idle() const;
+    // Runs effects in order, see Effect::run.
+    bool run(int16_t * data, size_t frames, int channels, bool silent);
+};
+
+enum BiquadType {
+    biquadLowPass,
+    biquadHighPass
+};
+
+// Second order filter, cutoff may be changed while playing.
+class BiquadFilter : public Effect {
+public:
+    BiquadFilter(BiquadType type, int frequency, float q = 0.7071f);
+
+    void frequency(int value);
+protected:
+    void process(int16_t * data, size_t frames, int channels);
+    size_t tail() const;
+    void reset();
+private:
+    struct Coefficients {
+        float b0, b1, b2, a1, a2;
+    };
+
+    void update();
+
+    BiquadType type_;
+    int rate_;
+    float q_;
+    volatile int frequency_;
+    volatile int dirty_;
+    Coefficients coefficients_;
+    float state_[2][4];
+};
+
+// Echo with feedback. Gains are 0x100 for unchanged level.
+class Delay : public Effect {
+public:
+    Delay(int delayMs, int feedback, int wet);
+    ~Delay();
+protected:
+    void process(int16_t * data, size_t frames, int channels);
+    size_t tail() const;
+    void reset();
+private:
+    Delay(const Delay &);
+    void operator=(const Delay &);
+
+    size_t frames_;
+    int feedback_;
+    int wet_;
+    int16_t * lines_[2];
+    size_t pos_;
+};
+
+// Schroeder reverb, four parallel combs followed by two allpasses per
+// channel. roomSize and damping are in 0..0x100, wet 0x100 is unchanged level.
+class Reverb : public Effect {
+public:
+    Reverb(int roomSize, int damping, int wet);
+    ~Reverb();
+protected:
+    void process(int16_t * data, size_t frames, int channels);
+    size_t tail() const;
+    void reset();
+private:
+    Reverb(const Reverb &);
+    void operator=(const Reverb &);
+
+    static const int combs = 4;
+    static const int allpasses = 2;
+
+    struct Line {
+        int16_t * data;
+        size_t size;
+        size_t pos;
+        int filter;
+    };
+
+    int feedback_;
+    int damping_;
+    int wet_;
+    Line combs_[2][combs];
+    Line allpasses_[2][allpasses];
+};
+
+}
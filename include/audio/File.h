@@ -1,14 +1,51 @@
 #pragma once
 
+#include "audio/Buffer.h"
+
 namespace audio {
 
+// Files give mono samples, Decoder and OnFlyDecoder expect that from both
+// read and readFloat. Files with more channels average them.
 class File {
 public:
+    // Reads up to len bytes of 16 bit samples, returns number of read bytes,
+    // 0 at the end.
     virtual long read(void * out, size_t len) = 0;
+    // Reads up to frames mono samples in -1..1 range, returns number of read
+    // frames, 0 at the end. Returns -1 if file cannot read floats, frames = 0
+    // only checks that.
+    virtual long readFloat(float * out, size_t frames) { return -1; }
     virtual int rate() = 0;
     virtual void rewind() = 0;
 
+    // Total number of sample frames, -1 if unknown.
+    virtual int64_t length() { return -1; }
+
+    // Positions file at the given sample frame, returns false if seeking is
+    // not supported or frame is out of range.
+    virtual bool seek(int64_t frame)
+    {
+        if(frame != 0)
+            return false;
+        rewind();
+        return true;
+    }
+
+    // Whole file as 16 bit mono samples when it is stored that way, shares
+    // storage with the file data. Empty if samples have to be decoded.
+    virtual Buffer pcm() { return Buffer(); }
+
+    // Does work that can be done ahead of reads, such as opening the next
+    // track. Called by OnFlyDecoder::poll when its ring is full.
+    virtual void poll() {}
+
     virtual ~File() {}
 };
 
+// Picks File implementation by content: WavFile for RIFF WAVE, OggFile for
+// Ogg streams, RawFile at rawRate (0 means output rate) for anything else.
+// Caller owns result, returns 0 for unsupported WAV formats.
+File * openFile(const Buffer & data, int rawRate = 0);
+File * openFile(const char * fname, int rawRate = 0);
+
 }
@@ -1,22 +1,136 @@
 #pragma once
 
+#include "audio/Spatial.h"
+
 namespace audio {
 
 class Buffer;
+class Effect;
 class Source;
 
+// Maximum number of voices playing at once.
+const size_t maxVoices = 0x20;
+// Largest processing block, see Manager::blockSize.
+const int maxBlockFrames = 0x200;
+// Voices are mixed to buses, bus 0 is the default one.
+const int busCount = 4;
+
+enum VoiceState {
+    voicePlaying,
+    voiceStarving,  // source had no data for the last callback
+    voiceFinished,  // reported once, source is removed after that
+    voiceCulled     // positional source beyond its max distance, not mixed
+};
+
+// State of one voice as of the last audio callback.
+struct VoiceSnapshot {
+    unsigned id;
+    VoiceState state;
+    int position;
+    // Levels are filled only while metering is enabled.
+    int peak;
+    int rms;
+};
+
+struct Meter {
+    int peak;
+    int rms;
+};
+
+// Levels of the last audio callback.
+struct MeterSnapshot {
+    Meter master;
+    Meter buses[busCount];
+};
+
+// Output timing as of the last audio callback. Callback size is chosen by the
+// device and s3eSound cannot request one, so output latency is not
+// configurable. Processing blocks only split callbacks and do not lower it.
+struct LatencyInfo {
+    int outputRate;
+    int callbackFrames;
+    int maxCallbackFrames;
+    int blockFrames;
+    // Time one callback covers, the least latency the device adds.
+    int callbackUs;
+    // Assumed device queue depth, see Manager::outputQueue.
+    int queueCallbacks;
+    // Measured from play() to the estimated moment the first sample is
+    // heard, -1 until a voice was measured. The estimate assumes output is
+    // heard queueCallbacks callbacks after it is mixed.
+    int triggerUs;
+    int maxTriggerUs;
+};
+
+typedef void (*FinishCallback)(unsigned id, void * userData);
+
+enum InstancePolicy {
+    instanceStealOldest,  // stop the oldest voice of the sample
+    instanceReject,       // do not start new voice
+    instanceCoalesce      // boost the newest voice if it was started within window, otherwise steal
+};
+
 class Manager {
 public:
     Manager();
     ~Manager();
 
     void start();
+    // Returns once audio callback acknowledged the stop. Voices, pools and
+    // buffers are kept, so start() resumes without allocating.
     void stop();
     void poll();
 
     Source * play(const Buffer & sample);
     Source * play(Source * source);
     void stop(Source * source);
+
+    // Limits number of voices playing the sample at once, instances = 0 removes the limit.
+    // window is in milliseconds and is used by instanceCoalesce.
+    void limitInstances(const Buffer & sample, int instances, InstancePolicy policy, int window = 30);
+
+    // Copies voices published by the last audio callback, never blocks the
+    // audio thread. Returns number of copied voices.
+    size_t voices(VoiceSnapshot * out, size_t capacity = maxVoices) const;
+
+    // Outputs stereo when device supports it, positional voices are panned
+    // then. Must be called before start.
+    void stereo(bool enabled);
+
+    // Listener and emitter changes reach audio thread in poll.
+    void listener(const Listener & value);
+    // Makes source positional. It is attenuated and panned by its position
+    // relative to listener and culled while beyond its max distance.
+    void emitter(Source * source, const Emitter & value);
+
+    // Inserts effect at the end of voice or bus chain, up to maxEffects per
+    // chain. Manager owns the effect, it is deleted once the voice finishes or
+    // the chain is cleared. Voice effects end with the voice, put long tails
+    // such as reverb on a bus.
+    void addEffect(Source * source, Effect * effect);
+    void addEffect(int bus, Effect * effect);
+    void clearEffects(Source * source);
+    void clearEffects(int bus);
+
+    void bus(Source * source, int bus);
+    void busVolume(int bus, int value);
+
+    // Voice, bus and master levels are measured only while enabled, otherwise
+    // voices are mixed straight to output.
+    void metering(bool enabled);
+    // Returns false if metering is disabled.
+    bool meters(MeterSnapshot & out) const;
+
+    // Processing granularity in frames, each callback is mixed in blocks of
+    // this size, up to maxBlockFrames. 0 selects maxBlockFrames. Smaller
+    // blocks keep working buffers in cache, they do not lower latency.
+    void blockSize(int frames);
+    // Number of callbacks the device queues ahead of the one being heard,
+    // used to estimate trigger latency. Defaults to 1.
+    void outputQueue(int callbacks);
+    void latency(LatencyInfo & out) const;
+    // Called from poll() with ids of voices that finished playing.
+    void onFinish(FinishCallback callback, void * userData);
 private:
     class Impl;
     std::auto_ptr<Impl> impl_;
@@ -0,0 +1,33 @@
+#pragma once
+
+namespace audio {
+
+enum MemoryCategory {
+    memorySamples,   // Buffer contents
+    memoryStreams,   // OnFlyDecoder rings and preroll
+    memoryDecoder,   // decode scratch buffers
+    memoryVoices,    // sources that did not fit into pools
+    memoryEffects,   // effect delay lines
+    memoryOther,     // allocations through installed s3e memory manager
+    memoryCategories
+};
+
+struct MemoryStats {
+    size_t inUse;
+    size_t peak;
+    size_t allocations;
+};
+
+// Allocations keep the alignment of malloc and are accounted in their category.
+void * allocate(size_t size, MemoryCategory category);
+void * reallocate(void * data, size_t size);
+void deallocate(void * data);
+
+MemoryStats memoryStats(MemoryCategory category);
+
+// Routes s3e user memory manager through accounted allocator, as memoryOther.
+// Install before the first s3e allocation, blocks made earlier are passed to
+// the previous user manager and cannot be freed without one.
+void installMemoryManager();
+
+}
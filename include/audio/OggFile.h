@@ -15,9 +15,14 @@ public:
     OggFile(const Buffer & buffer);
     ~OggFile();
 
+    // Both reads average channels.
     long read(void * out, size_t len);
+    // Takes decoder output before int16 conversion.
+    long readFloat(float * out, size_t frames);
     int rate();
     void rewind();
+    bool seek(int64_t frame);
+    int64_t length();
     OggVorbis_File * handle();
 private:
     class Impl;
@@ -2,6 +2,7 @@
 
 #include <memory>
 
+#include "audio/Resampler.h"
 #include "audio/Source.h"
 
 namespace audio {
@@ -10,15 +11,26 @@ class File;
 
 class OnFlyDecoder : public Source {
 public:
-    OnFlyDecoder(bool owned, File & file);
+    OnFlyDecoder(bool owned, File & file, ResamplerType resampler = resamplerSpeex);
     ~OnFlyDecoder();
 
     File & source();
     void volume(int value);
+    void playbackRate(int value);
+
+    // Loop region in sample frames of the source, end < 0 means end of file.
+    // Beginning of the region is decoded in advance, so wrap is gapless.
+    void loop(int64_t begin, int64_t end = -1);
+    // Restarts playback from the given sample frame of the source, takes
+    // effect on next poll().
+    void seek(int64_t frame);
 
     bool poll();
     bool pollable() { return true; }
     int mix(int16_t * out, int limit);
+    // Consumes decoded samples, streams keep playing silently while culled.
+    int skip(int limit);
+    int position() const;
 private:
     class Impl;
     std::auto_ptr<Impl> impl_;
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+
+#include "audio/File.h"
+
+namespace audio {
+
+// Plays several files one after another as a single stream. Beginning of the
+// next track is opened and decoded ahead by poll() while the current one is
+// playing, so OnFlyDecoder fed by a playlist switches tracks without gaps.
+// All tracks must have the same sample rate.
+class Playlist : public File {
+public:
+    Playlist();
+    ~Playlist();
+
+    // Appends track, owned tracks are deleted by playlist.
+    void add(File * file, bool owned);
+    // Length of crossfade between tracks in sample frames, 0 joins tracks
+    // without gap. Crossfade needs tracks with known length.
+    void crossfade(int frames);
+    // Starts from the first track after the last one is finished. A single
+    // track is rewound at its end, without prefetch or crossfade.
+    void loop(bool value);
+
+    long read(void * out, size_t len);
+    void poll();
+    int rate();
+    void rewind();
+    // Frame counts tracks joined by crossfade once. Tracks before the target
+    // one must have known length, the target one must support the seek.
+    bool seek(int64_t frame);
+    int64_t length();
+private:
+    class Impl;
+    std::auto_ptr<Impl> impl_;
+};
+
+}
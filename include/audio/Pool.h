@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomics.h>
+
+#include "audio/Memory.h"
+
+namespace audio {
+
+extern AtomicFunctions atomics;
+
+// Fixed storage for size objects of type T, used from class operator new and
+// delete so steady state allocates nothing. When exhausted, or asked for other
+// than sizeof(T) by a derived class, falls back to heap.
+template<class T, size_t size>
+class ObjectPool {
+public:
+    ObjectPool()
+        : lock_(0), free_(0)
+    {
+        for(size_t i = size; i-- > 0;)
+        {
+            slots_[i].next = free_;
+            free_ = &slots_[i];
+        }
+    }
+
+    void * allocate(size_t bytes)
+    {
+        if(bytes != sizeof(T))
+            return audio::allocate(bytes, memoryVoices);
+        lock();
+        Slot * result = free_;
+        if(result)
+            free_ = result->next;
+        unlock();
+        return result ? result->data : audio::allocate(sizeof(T), memoryVoices);
+    }
+
+    void deallocate(void * data)
+    {
+        Slot * slot = static_cast<Slot*>(data);
+        if(slot < slots_ || slot >= slots_ + size)
+        {
+            audio::deallocate(data);
+            return;
+        }
+        lock();
+        slot->next = free_;
+        free_ = slot;
+        unlock();
+    }
+private:
+    void lock()
+    {
+        while(atomics.cas(&lock_, 0, 1))
+            atomics.sched_yield();
+    }
+
+    void unlock()
+    {
+        atomics.cas(&lock_, 1, 0);
+    }
+
+    union Slot {
+        Slot * next;
+        char data[sizeof(T)];
+        double alignDouble;
+        int64_t alignInt;
+    };
+
+    volatile int lock_;
+    Slot * free_;
+    Slot slots_[size];
+};
+
+}
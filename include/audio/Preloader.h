@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "audio/Buffer.h"
+#include "audio/Resampler.h"
+
+namespace audio {
+
+enum PreloadMode {
+    preloadRaw,     // file contents as is
+    preloadDecode,  // ogg decoded and resampled to output rate
+    preloadAdpcm    // decoded and compressed with encodeAdpcm
+};
+
+struct PreloadProgress {
+    size_t assetsDone;
+    size_t assetsTotal;
+    uint64 bytesDone;
+    // Sizes of files that were not opened yet are estimated.
+    uint64 bytesTotal;
+    // Estimated time left in milliseconds, -1 until first asset is loaded.
+    int timeLeft;
+};
+
+// Loads a list of assets on several worker threads, so reading, decoding and
+// resampling of different assets overlap. Assets with higher priority start first.
+class Preloader {
+public:
+    Preloader();
+    // Cancels loading and waits for workers.
+    ~Preloader();
+
+    // Returns index that should be passed to result().
+    size_t add(const std::string & fname, PreloadMode mode = preloadDecode, int priority = 0, int volume = 0x100,
+               ResamplerType resampler = resamplerSpeex);
+
+    // Starts up to threads workers, when none can be created everything is
+    // loaded before start returns.
+    void start(int threads = 2);
+    void cancel();
+    // True when everything is loaded or loading was cancelled and workers stopped.
+    bool done() const;
+    PreloadProgress progress() const;
+
+    // Loaded asset, empty if it is not loaded yet or loading failed.
+    Buffer result(size_t index) const;
+private:
+    class Impl;
+    std::auto_ptr<Impl> impl_;
+};
+
+}
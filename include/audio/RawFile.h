@@ -23,6 +23,16 @@ public:
 
     int rate() { return rate_; }
     void rewind() { pos_ = buffer_.data(); }
+    int64_t length() { return buffer_.size() / 2; }
+    Buffer pcm() { return buffer_.slice(0, buffer_.size() & ~1); }
+
+    bool seek(int64_t frame)
+    {
+        if(frame < 0 || static_cast<uint64_t>(frame) * 2 > buffer_.size())
+            return false;
+        pos_ = buffer_.data() + frame * 2;
+        return true;
+    }
 private:
     Buffer buffer_;
     const char * pos_;
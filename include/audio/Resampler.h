@@ -0,0 +1,42 @@
+#pragma once
+
+namespace audio {
+
+enum ResamplerType {
+    resamplerSpeex,   // speex filter, quality 0
+    resamplerLinear,  // linear interpolation, cheapest
+    resamplerCubic    // 4 point hermite interpolation
+};
+
+// Converts mono 16 bit stream between rates, state is kept between calls.
+class Resampler {
+public:
+    Resampler(int inputRate, int outputRate)
+        : inputRate_(inputRate), outputRate_(outputRate)
+    {
+    }
+
+    inline int inputRate() const { return inputRate_; }
+    inline int outputRate() const { return outputRate_; }
+
+    // Consumes up to inlen input samples and produces up to outlen output,
+    // both are updated with processed counts.
+    virtual void process(const int16_t * in, uint32_t & inlen, int16_t * out, uint32_t & outlen) = 0;
+    // Same for samples in -1..1 range. Resamplers working on integers convert
+    // through int16, speex and equal rate copy run on floats directly.
+    virtual void processFloat(const float * in, uint32_t & inlen, float * out, uint32_t & outlen);
+    // Changes ratio without dropping state.
+    virtual void rates(int inputRate, int outputRate) = 0;
+    // Forgets history, used after seeking.
+    virtual void reset() = 0;
+
+    virtual ~Resampler() {}
+protected:
+    int inputRate_;
+    int outputRate_;
+};
+
+// Equal rates give a resampler that only copies until rates are changed.
+Resampler * createResampler(ResamplerType type, int inputRate, int outputRate);
+
+}
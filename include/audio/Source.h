@@ -1,24 +1,58 @@
 #pragma once
 
+#include "audio/Effect.h"
+#include "audio/Spatial.h"
+
 namespace audio {
 
 class Source {
 public:
     Source(bool owned)
-        : owned_(owned)
+        : owned_(owned), id_(0), bus_(0), positional_(false), mixPositional_(false), triggered_(0)
     {
+        effects_.size = 0;
     }
 
     inline bool owned() const { return owned_; }
+    // Assigned by Manager when source starts playing.
+    inline unsigned id() const { return id_; }
 
     virtual bool pollable() = 0;
     virtual int mix(int16_t * out, int limit) = 0;
 
     virtual bool poll() { return false; }
 
+    // Advances playback by limit frames without producing output, used for
+    // culled voices. Returns -1 when source is finished, 0 if it cannot skip
+    // and stays where it is.
+    virtual int skip(int limit) { return 0; }
+
+    // Frames mixed so far, -1 if unknown.
+    virtual int position() const { return -1; }
+
+    // Gain where 0x100 is unchanged level, sources without volume ignore it.
+    virtual void volume(int value) {}
+
+    // Playback rate in 16.16 fixed point, 0x10000 plays at normal speed.
+    // Applied at mix time, sources that cannot change rate ignore it.
+    virtual void playbackRate(int value) {}
+
     virtual ~Source() {}
 private:
+    friend class Manager;
+
     bool owned_;
+    unsigned id_;
+    int bus_;
+    // Set by game thread, published to mix* copies in Manager::poll.
+    bool positional_;
+    Emitter emitter_;
+    bool mixPositional_;
+    Emitter mixEmitter_;
+    // Owned by Manager, changed under its lock.
+    EffectChain effects_;
+    // Time of play() in nanoseconds, cleared by audio thread once measured.
+    uint64 triggered_;
 };
 
 }
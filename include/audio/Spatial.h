@@ -0,0 +1,38 @@
+#pragma once
+
+namespace audio {
+
+struct Vector3 {
+    float x;
+    float y;
+    float z;
+};
+
+enum AttenuationCurve {
+    attenuationLinear,        // falls to silence at maxDistance
+    attenuationInverse,       // minDistance / distance
+    attenuationInverseSquare  // (minDistance / distance)^2
+};
+
+struct Listener {
+    Vector3 position;
+    // Unit vector pointing to the right ear, used for stereo pan.
+    Vector3 right;
+};
+
+// Emitter is at full level up to minDistance, which must be positive for
+// inverse curves, and silent from maxDistance on.
+struct Emitter {
+    Vector3 position;
+    float minDistance;
+    float maxDistance;
+    AttenuationCurve curve;
+};
+
+// Computes left and right gains of count emitters, 0x100 is unchanged level.
+// Stereo pan keeps constant power, so centered emitter plays 3dB lower in each
+// channel. In mono both gains are equal. Gains are zero beyond maxDistance.
+void spatialize(const Listener & listener, const Emitter * emitters, size_t count, bool stereo,
+                int * left, int * right);
+
+}
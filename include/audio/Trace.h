@@ -0,0 +1,51 @@
+#pragma once
+
+// Timeline tracing, compiled in only when AUDIO_TRACE is defined. Spans are
+// recorded into per-thread rings without locks and dumped as Chrome trace
+// JSON, open it in chrome://tracing or Perfetto. Names must be literals.
+
+#ifdef AUDIO_TRACE
+
+#include <s3eTypes.h>
+
+namespace audio {
+
+// Records span from construction to destruction on calling thread's ring.
+// Threads are told apart by s3eThreadGetCurrent, which is the same for every
+// thread not started through s3eThread, so spans in the audio callback go to
+// a ring of their own.
+class TraceScope {
+public:
+    explicit TraceScope(const char * name, bool callback = false);
+    ~TraceScope();
+private:
+    TraceScope(const TraceScope &);
+    void operator=(const TraceScope &);
+
+    const char * name_;
+    uint64 begin_;
+    bool callback_;
+};
+
+}
+
+#define AUDIO_TRACE_JOIN2(a, b) a##b
+#define AUDIO_TRACE_JOIN(a, b) AUDIO_TRACE_JOIN2(a, b)
+#define AUDIO_TRACE_SCOPE(name) audio::TraceScope AUDIO_TRACE_JOIN(audioTraceScope, __LINE__)(name)
+// For code running in the sound callback only.
+#define AUDIO_TRACE_CALLBACK_SCOPE(name) audio::TraceScope AUDIO_TRACE_JOIN(audioTraceScope, __LINE__)(name, true)
+
+#else
+
+#define AUDIO_TRACE_SCOPE(name)
+#define AUDIO_TRACE_CALLBACK_SCOPE(name)
+
+#endif
+
+namespace audio {
+
+// Writes recorded spans to fname. Spans recorded while dumping may be torn.
+// Returns false when tracing is compiled out or file cannot be written.
+bool dumpTrace(const char * fname);
+
+}
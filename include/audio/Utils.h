@@ -1,20 +1,43 @@
 #pragma once
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include <atomics.h>
 
-struct SpeexResamplerState_;
-typedef struct SpeexResamplerState_ SpeexResamplerState;
-
 namespace audio {
 
 class Buffer;
+class BufferAllocator;
 class File;
+class Resampler;
 
-void resample(SpeexResamplerState * resampler, int16_t * buffer, size_t & filled, std::vector<int16_t> & out);
+void resample(Resampler & resampler, int16_t * buffer, size_t & filled, std::vector<int16_t> & out);
+// Float variant, output is quantized to int16 with volume applied in the same pass.
+void resample(Resampler & resampler, float * buffer, size_t & filled, int volume, std::vector<int16_t> & out);
+// Converts samples in -1..1 range to int16 with rounding and clipping.
+void quantize(int16_t * out, const float * inp, int volume, size_t samples);
 void mix(bool mix, int16_t * out, int16_t * inp, int volume, size_t samples);
+// Mixes inp played with step (16.16 fixed point) into out using linear interpolation.
+// phase is fractional position in inp, it is updated to stay relative to the first
+// sample that was not consumed. Returns number of produced samples.
+size_t mixResampled(int16_t * out, const int16_t * inp, size_t available, uint32_t & phase, uint32_t step,
+                    int volume, size_t samples, size_t & consumed);
+
+// Adds mono inp to interleaved stereo out with separate left and right gains.
+void mixPanned(int16_t * out, const int16_t * inp, int left, int right, size_t samples);
+
+// Raises peak to peak absolute value of data and adds squares of samples to squares.
+void measure(const int16_t * data, size_t samples, int & peak, int64_t & squares);
+int rms(int64_t squares, size_t samples);
+
+const int normalRate = 0x10000;
+
+inline int clampRate(int value)
+{
+    return std::max(1, std::min(value, normalRate * 8));
+}
 
 extern AtomicFunctions atomics;
 
@@ -33,5 +56,6 @@ inline void atomicsWrite(volatile int * x, int v)
 
 Buffer loadFile(const char * fname);
 Buffer loadFile(const std::string & fname);
+Buffer loadFile(const char * fname, BufferAllocator & allocator);
 
 }
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "audio/Buffer.h"
+#include "audio/File.h"
+
+namespace audio {
+
+// RIFF WAVE with 16 bit PCM, mono or stereo. Samples are read straight from
+// the buffer, nothing is decoded. Stereo is mixed down to mono on read.
+class WavFile : public File {
+public:
+    explicit WavFile(const Buffer & buffer);
+
+    // True if buffer starts with RIFF WAVE header, format is not checked.
+    static bool detect(const Buffer & buffer);
+    // False if header is broken or format is not supported.
+    bool valid() const { return !data_.empty(); }
+    int channels() const { return channels_; }
+
+    long read(void * out, size_t len);
+    int rate() { return rate_; }
+    void rewind() { pos_ = 0; }
+    int64_t length() { return frames_; }
+    bool seek(int64_t frame);
+    Buffer pcm();
+private:
+    Buffer data_;
+    int rate_;
+    int channels_;
+    size_t frames_;
+    size_t pos_;
+};
+
+}
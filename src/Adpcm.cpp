@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <limits>
+
+#include "audio/Pool.h"
+
+#include "audio/Adpcm.h"
+
+namespace audio {
+
+namespace {
+
+// Stream is 4 bytes of frame count followed by blocks. Every block starts
+// with the first sample and step index, then two samples per byte follow,
+// low nibble first.
+const size_t headerSize = 4;
+const size_t blockHeaderSize = 4;
+const size_t blockSize = 0x100;
+const int blockFrames = (blockSize - blockHeaderSize) * 2 + 1;
+
+const int indexTable[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+const int stepTable[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+inline int clamp(int v, int min, int max)
+{
+    return v < min ? min : (v > max ? max : v);
+}
+
+// Applies nibble to decoder state and returns new sample.
+inline int decodeNibble(int nibble, int & predictor, int & index)
+{
+    int step = stepTable[index];
+    int diff = step >> 3;
+    if(nibble & 4)
+        diff += step;
+    if(nibble & 2)
+        diff += step >> 1;
+    if(nibble & 1)
+        diff += step >> 2;
+    predictor = clamp(nibble & 8 ? predictor - diff : predictor + diff, -0x8000, 0x7fff);
+    index = clamp(index + indexTable[nibble & 7], 0, 88);
+    return predictor;
+}
+
+int encodeNibble(int sample, int & predictor, int & index)
+{
+    int step = stepTable[index];
+    int diff = sample - predictor;
+    int nibble = 0;
+    if(diff < 0)
+    {
+        nibble = 8;
+        diff = -diff;
+    }
+    if(diff >= step)
+    {
+        nibble |= 4;
+        diff -= step;
+    }
+    if(diff >= step >> 1)
+    {
+        nibble |= 2;
+        diff -= step >> 1;
+    }
+    if(diff >= step >> 2)
+        nibble |= 1;
+    decodeNibble(nibble, predictor, index);
+    return nibble;
+}
+
+ObjectPool<AdpcmSource, 0x40> & pool()
+{
+    static ObjectPool<AdpcmSource, 0x40> result;
+    return result;
+}
+
+inline const unsigned char * blockAddress(const Buffer & data, int frame)
+{
+    return reinterpret_cast<const unsigned char*>(data.data()) + headerSize + (frame / blockFrames) * blockSize;
+}
+
+}
+
+Buffer encodeAdpcm(const Buffer & pcm, BufferAllocator & allocator)
+{
+    const int16_t * input = reinterpret_cast<const int16_t*>(pcm.data());
+    int frames = pcm.size() / 2;
+    int blocks = (frames + blockFrames - 1) / blockFrames;
+
+    Buffer result(headerSize + blocks * blockSize, allocator);
+    unsigned char * out = reinterpret_cast<unsigned char*>(result.data());
+    memset(out, 0, result.size());
+    out[0] = frames & 0xff;
+    out[1] = (frames >> 8) & 0xff;
+    out[2] = (frames >> 16) & 0xff;
+    out[3] = (frames >> 24) & 0xff;
+    out += headerSize;
+
+    int index = 0;
+    for(int frame = 0; frame < frames; frame += blockFrames, out += blockSize)
+    {
+        int predictor = input[frame];
+        out[0] = predictor & 0xff;
+        out[1] = (predictor >> 8) & 0xff;
+        out[2] = index;
+
+        int count = std::min(blockFrames, frames - frame) - 1;
+        for(int i = 0; i != count; ++i)
+        {
+            int nibble = encodeNibble(input[frame + 1 + i], predictor, index);
+            out[blockHeaderSize + i / 2] |= (i & 1) ? nibble << 4 : nibble;
+        }
+    }
+
+    return result;
+}
+
+AdpcmSource::AdpcmSource(bool owned, const Buffer & data)
+    : Source(owned), data_(data), frames_(0), pos_(0), predictor_(0), index_(0), volume_(0x100)
+{
+    // Empty or truncated streams play nothing.
+    if(data_.size() < headerSize)
+        return;
+    const unsigned char * header = reinterpret_cast<const unsigned char*>(data_.data());
+    int frames = header[0] | (header[1] << 8) | (header[2] << 16) | (header[3] << 24);
+    if(frames <= 0)
+        return;
+    uint64_t blocks = (frames - 1) / blockFrames + 1;
+    if(data_.size() >= headerSize + blocks * blockSize)
+        frames_ = frames;
+}
+
+void * AdpcmSource::operator new(size_t size)
+{
+    return pool().allocate(size);
+}
+
+void AdpcmSource::operator delete(void * data)
+{
+    pool().deallocate(data);
+}
+
+void AdpcmSource::volume(int value)
+{
+    volume_ = value;
+}
+
+int AdpcmSource::mix(int16_t * out, int limit)
+{
+    int left = frames_ - pos_;
+    if(!left)
+        return -1;
+    int result = std::min(limit, left);
+
+    typedef std::numeric_limits<int16_t> limits;
+    int min = limits::min();
+    int max = limits::max();
+    int volume = volume_;
+    int predictor = predictor_;
+    int index = index_;
+    int pos = pos_;
+    int16_t * stop = out + result;
+    while(out != stop)
+    {
+        const unsigned char * block = blockAddress(data_, pos);
+        int inBlock = pos % blockFrames;
+        if(!inBlock)
+        {
+            predictor = static_cast<int16_t>(block[0] | (block[1] << 8));
+            index = clamp(block[2], 0, 88);
+            *out = clamp(*out + predictor * volume / 0x100, min, max);
+            ++out;
+            ++pos;
+            continue;
+        }
+
+        int count = std::min<int>(blockFrames - inBlock, stop - out);
+        const unsigned char * nibbles = block + blockHeaderSize;
+        for(int i = inBlock - 1, end = i + count; i != end; ++i, ++out)
+        {
+            int nibble = (i & 1) ? nibbles[i / 2] >> 4 : nibbles[i / 2] & 0xf;
+            *out = clamp(*out + decodeNibble(nibble, predictor, index) * volume / 0x100, min, max);
+        }
+        pos += count;
+    }
+
+    predictor_ = predictor;
+    index_ = index;
+    pos_ = pos;
+    return result;
+}
+
+int AdpcmSource::position() const
+{
+    return pos_;
+}
+
+}
@@ -0,0 +1,142 @@
+#include <algorithm>
+
+#include <s3eSound.h>
+
+#include <IwDebug.h>
+
+#include "audio/OggFile.h"
+#include "audio/RawFile.h"
+#include "audio/Utils.h"
+
+#include "audio/Bank.h"
+
+namespace audio {
+
+namespace {
+
+const char bankMagic[4] = { 'A', 'B', 'N', 'K' };
+const uint32_t bankVersion = 1;
+const size_t headerSize = 12;
+const size_t entrySize = 20;
+
+inline uint32_t read32(const unsigned char * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint16_t read16(const unsigned char * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+bool entryLess(const BankEntry & lhs, const BankEntry & rhs)
+{
+    return lhs.hash < rhs.hash;
+}
+
+bool entryHashLess(const BankEntry & lhs, uint32_t hash)
+{
+    return lhs.hash < hash;
+}
+
+}
+
+uint32_t bankHash(const char * name)
+{
+    uint32_t result = 2166136261u;
+    for(; *name; ++name)
+    {
+        result ^= static_cast<unsigned char>(*name);
+        result *= 16777619u;
+    }
+    return result;
+}
+
+Bank::Bank()
+{
+}
+
+Bank::Bank(const Buffer & data)
+{
+    load(data);
+}
+
+bool Bank::load(const char * fname)
+{
+    return load(loadFile(fname));
+}
+
+bool Bank::load(const Buffer & data)
+{
+    data_.reset();
+    entries_.clear();
+
+    const unsigned char * p = reinterpret_cast<const unsigned char*>(data.data());
+    size_t size = data.size();
+    if(size < headerSize || memcmp(p, bankMagic, sizeof(bankMagic)) || read32(p + 4) != bankVersion)
+    {
+        IwAssertMsg(AUDIO_BANK, false, ("Invalid sound bank"));
+        return false;
+    }
+
+    uint32_t count = read32(p + 8);
+    if((size - headerSize) / entrySize < count)
+    {
+        IwAssertMsg(AUDIO_BANK, false, ("Truncated sound bank index: %d", static_cast<int>(count)));
+        return false;
+    }
+
+    entries_.reserve(count);
+    for(const unsigned char * e = p + headerSize, * end = e + count * entrySize; e != end; e += entrySize)
+    {
+        uint32_t offset = read32(e + 4);
+        uint32_t length = read32(e + 8);
+        if(offset > size || length > size - offset)
+        {
+            IwAssertMsg(AUDIO_BANK, false, ("Sound bank entry out of range: %x", read32(e)));
+            entries_.clear();
+            return false;
+        }
+
+        BankEntry entry;
+        entry.hash = read32(e);
+        entry.codec = static_cast<BankCodec>(read16(e + 12));
+        entry.rate = read32(e + 16);
+        entry.data = data.slice(offset, length);
+        entries_.push_back(entry);
+    }
+    std::sort(entries_.begin(), entries_.end(), entryLess);
+
+    data_ = data;
+    return true;
+}
+
+const BankEntry * Bank::find(uint32_t hash) const
+{
+    std::vector<BankEntry>::const_iterator i = std::lower_bound(entries_.begin(), entries_.end(), hash, entryHashLess);
+    return i != entries_.end() && i->hash == hash ? &*i : 0;
+}
+
+const BankEntry * Bank::find(const char * name) const
+{
+    return find(bankHash(name));
+}
+
+const BankEntry * Bank::find(const std::string & name) const
+{
+    return find(bankHash(name.c_str()));
+}
+
+File * Bank::open(const BankEntry & entry)
+{
+    switch(entry.codec) {
+    case bankPcm:
+        return new RawFile(entry.data, entry.rate);
+    case bankOgg:
+        return new OggFile(entry.data);
+    default:
+        return 0;
+    }
+}
+
+}
@@ -0,0 +1,40 @@
+#include <stdint.h>
+
+#include <IwDebug.h>
+
+#include "audio/Memory.h"
+
+#include "audio/Buffer.h"
+
+namespace audio {
+
+namespace {
+
+// Over-allocates from the accounted heap and keeps the original pointer right
+// in front of the aligned block, so any malloc granularity works.
+class DefaultBufferAllocator : public BufferAllocator {
+public:
+    void * allocate(size_t size)
+    {
+        char * raw = static_cast<char*>(audio::allocate(size + Buffer::alignment + sizeof(void*), memorySamples));
+        IwAssertMsg(AUDIO_BUFFER, raw, ("Failed to allocate buffer: %d", static_cast<int>(size)));
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + Buffer::alignment - 1) & ~(Buffer::alignment - 1);
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    void deallocate(void * data, size_t size)
+    {
+        audio::deallocate(static_cast<void**>(data)[-1]);
+    }
+};
+
+}
+
+BufferAllocator & defaultBufferAllocator()
+{
+    static DefaultBufferAllocator result;
+    return result;
+}
+
+}
@@ -1,11 +1,13 @@
 #include <limits>
 
 #include <s3eSound.h>
-
-#include "speex/speex_resampler.h"
+#include <s3eTimer.h>
 
 #include "audio/Buffer.h"
-#include "audio/OggFile.h"
+#include "audio/File.h"
+#include "audio/Memory.h"
+#include "audio/Resampler.h"
+#include "audio/Trace.h"
 #include "audio/Utils.h"
 
 #include "audio/Decoder.h"
@@ -15,76 +17,263 @@ namespace audio {
 namespace {
 
 const size_t decodeBufferSize = 0x2000;
+const size_t jobDecodeBufferSize = 0x800;
+
+// Reads next portion of file into decodeBuffer and resamples it to out.
+// Returns false when file is exhausted and everything is flushed to out.
+bool decodeChunk(Resampler & resampler, File & file, int16_t * decodeBuffer, size_t bufferSize, size_t & decodeUsed, std::vector<int16_t> & out)
+{
+    long res = 1;
+    while(decodeUsed * 2 < bufferSize)
+    {
+        res = file.read(decodeBuffer + decodeUsed, (bufferSize - decodeUsed) * 2);
+        if(res <= 0)
+            break;
+        decodeUsed += res / 2;
+    }
+
+    if(decodeUsed)
+        resample(resampler, decodeBuffer, decodeUsed, out);
+
+    if(res > 0)
+        return true;
+
+    if(decodeUsed)
+        resample(resampler, decodeBuffer, decodeUsed, out);
+    return false;
+}
+
+// Float variant of decodeChunk, volume is applied while quantizing to out.
+// The buffer is the int16 one reused, its size is given in bytes.
+bool decodeFloatChunk(Resampler & resampler, File & file, float * decodeBuffer, size_t bufferBytes, size_t & decodeUsed,
+                      int volume, std::vector<int16_t> & out)
+{
+    size_t capacity = bufferBytes / sizeof(float);
+    long res = 1;
+    while(decodeUsed < capacity)
+    {
+        res = file.readFloat(decodeBuffer + decodeUsed, capacity - decodeUsed);
+        if(res <= 0)
+            break;
+        decodeUsed += res;
+    }
+
+    if(decodeUsed)
+        resample(resampler, decodeBuffer, decodeUsed, volume, out);
+
+    if(res > 0)
+        return true;
+
+    if(decodeUsed)
+        resample(resampler, decodeBuffer, decodeUsed, volume, out);
+    return false;
+}
 
+void applyVolume(std::vector<int16_t> & buffer, int volume)
+{
+    if(volume != 0x100)
+    {
+        typedef std::numeric_limits<int16_t> limits;
+        int min = limits::min();
+        int max = limits::max();
+        for(std::vector<int16_t>::iterator i = buffer.begin(), end = buffer.end(); i != end; ++i)
+            *i = std::max(min, std::min(max, *i * volume / 0x100));
+    }
+}
+
+Buffer makeBuffer(const std::vector<int16_t> & samples, BufferAllocator & allocator)
+{
+    if(samples.empty())
+        return Buffer(0, allocator);
+    return Buffer(reinterpret_cast<const char*>(&samples[0]), samples.size() * 2, allocator);
+}
+
+Resampler * fileResampler(ResamplerType type, File & file)
+{
+    return createResampler(type, file.rate(), s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ));
 }
 
-Decoder::Decoder()
-    : decodeBuffer_(new int16_t[decodeBufferSize])
+// Samples of file that needs neither decoding nor resampling, empty otherwise.
+Buffer readyPcm(File & file)
+{
+    Buffer result = file.pcm();
+    if(!result.empty() && file.rate() != s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ))
+        result.reset();
+    return result;
+}
+
+Buffer copyPcm(const Buffer & pcm, int volume, BufferAllocator & allocator)
+{
+    if(volume == 0x100)
+        return pcm;
+    Buffer result(pcm.size(), allocator);
+    mix(false, reinterpret_cast<int16_t*>(result.data()), reinterpret_cast<int16_t*>(pcm.data()), volume, pcm.size() / 2);
+    return result;
+}
+
+}
+
+Decoder::Decoder(ResamplerType resampler, bool floatPipeline)
+    : resampler_(resampler), floatPipeline_(floatPipeline), decodeBuffer_(static_cast<int16_t*>(allocate(decodeBufferSize * 2, memoryDecoder)))
 {
 }
 
 Decoder::~Decoder()
 {
-    delete decodeBuffer_;
+    deallocate(decodeBuffer_);
 }
 
-void decodeFile(SpeexResamplerState * resampler, OggFile & file, int16_t * decodeBuffer, std::vector<int16_t> & out)
+Buffer Decoder::decode(File & file, int volume, BufferAllocator & allocator)
 {
+    AUDIO_TRACE_SCOPE("Decoder::decode");
+    Buffer pcm = readyPcm(file);
+    if(!pcm.empty())
+        return copyPcm(pcm, volume, allocator);
+
+    std::auto_ptr<Resampler> resampler(fileResampler(resampler_, file));
+
+    buffer_.clear();
     size_t decodeUsed = 0;
-    for(;;)
+    if(floatPipeline_ && file.readFloat(0, 0) >= 0)
     {
-        long res = 1;
-        while(decodeUsed * 2 < decodeBufferSize)
+        float * decodeBuffer = reinterpret_cast<float*>(decodeBuffer_);
+        while(decodeFloatChunk(*resampler, file, decodeBuffer, decodeBufferSize * 2, decodeUsed, volume, buffer_))
+            ;
+        return makeBuffer(buffer_, allocator);
+    }
+
+    while(decodeChunk(*resampler, file, decodeBuffer_, decodeBufferSize, decodeUsed, buffer_))
+        ;
+
+    applyVolume(buffer_, volume);
+    return makeBuffer(buffer_, allocator);
+}
+
+class DecodeJob::Impl {
+public:
+    Impl(File & file, int volume, BufferAllocator & allocator, ResamplerType type, bool floatPipeline)
+        : file_(file), volume_(volume), allocator_(allocator), type_(type),
+          floatPipeline_(floatPipeline && file.readFloat(0, 0) >= 0),
+          decodeBuffer_(static_cast<int16_t*>(allocate(jobDecodeBufferSize * 2, memoryDecoder))), decodeUsed_(0), done_(false),
+          callback_(0), userData_(0)
+    {
+    }
+
+    ~Impl()
+    {
+        deallocate(decodeBuffer_);
+    }
+
+    void onComplete(Callback callback, void * userData)
+    {
+        callback_ = callback;
+        userData_ = userData;
+    }
+
+    bool step(int budgetUs)
+    {
+        if(done_)
+            return true;
+
+        Buffer pcm = readyPcm(file_);
+        if(!pcm.empty())
         {
-            int request = (decodeBufferSize - decodeUsed) * 2;
-            if(!request)
-            {
-                res = 1;
-                break;
-            }
-            res = file.read(decodeBuffer + decodeUsed, request);
-            if(res <= 0)
-                break;
-            decodeUsed += res / 2;
+            finish(copyPcm(pcm, volume_, allocator_));
+            return true;
         }
 
-        if(decodeUsed)
-            resample(resampler, decodeBuffer, decodeUsed, out);
+        uint64 deadline = s3eTimerGetUSTNanoseconds() + static_cast<uint64>(budgetUs) * 1000;
+        if(!resampler_.get())
+            resampler_.reset(fileResampler(type_, file_));
 
-        if(res <= 0)
-            break;
+        if(floatPipeline_)
+        {
+            float * decodeBuffer = reinterpret_cast<float*>(decodeBuffer_);
+            while(decodeFloatChunk(*resampler_, file_, decodeBuffer, jobDecodeBufferSize * 2, decodeUsed_, volume_, buffer_))
+                if(s3eTimerGetUSTNanoseconds() >= deadline)
+                    return false;
+            finish(makeBuffer(buffer_, allocator_));
+            return true;
+        }
+
+        while(decodeChunk(*resampler_, file_, decodeBuffer_, jobDecodeBufferSize, decodeUsed_, buffer_))
+            if(s3eTimerGetUSTNanoseconds() >= deadline)
+                return false;
+
+        applyVolume(buffer_, volume_);
+        finish(makeBuffer(buffer_, allocator_));
+        return true;
     }
 
-    if(decodeUsed)
-        resample(resampler, decodeBuffer, decodeUsed, out);
-}
+    bool done() const
+    {
+        return done_;
+    }
 
-Buffer Decoder::decode(OggFile & file, int volume)
+    const Buffer & result() const
+    {
+        return result_;
+    }
+private:
+    void finish(const Buffer & result)
+    {
+        resampler_.reset();
+        deallocate(decodeBuffer_);
+        decodeBuffer_ = 0;
+
+        result_ = result;
+        std::vector<int16_t>().swap(buffer_);
+        done_ = true;
+
+        if(callback_)
+            callback_(result_, userData_);
+    }
+
+    File & file_;
+    int volume_;
+    BufferAllocator & allocator_;
+    ResamplerType type_;
+    bool floatPipeline_;
+    std::auto_ptr<Resampler> resampler_;
+
+    int16_t * decodeBuffer_;
+    size_t decodeUsed_;
+    std::vector<int16_t> buffer_;
+    bool done_;
+    Buffer result_;
+
+    Callback callback_;
+    void * userData_;
+};
+
+DecodeJob::DecodeJob(File & file, int volume, BufferAllocator & allocator, ResamplerType resampler,
+                     bool floatPipeline)
+    : impl_(new Impl(file, volume, allocator, resampler, floatPipeline))
 {
-    int outputRate = s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ);
+}
 
-    int err = 0;
-    int inputRate = file.rate();
+DecodeJob::~DecodeJob()
+{
+}
 
-    SpeexResamplerState * resampler = speex_resampler_init(1, inputRate, outputRate, 0, &err);
+void DecodeJob::onComplete(Callback callback, void * userData)
+{
+    impl_->onComplete(callback, userData);
+}
 
-    buffer_.clear();
-    decodeFile(resampler, file, decodeBuffer_, buffer_);
+bool DecodeJob::step(int budgetUs)
+{
+    return impl_->step(budgetUs);
+}
 
-    speex_resampler_destroy(resampler);
-    
-    if(volume != 0x100)
-    {
-        typedef std::numeric_limits<int16_t> limits;
-        int min = limits::min();
-        int max = limits::max();
-        for(std::vector<int16_t>::iterator i = buffer_.begin(), end = buffer_.end(); i != end; ++i)
-            *i = std::max(min, std::min(max, *i * volume / 0x100));
-    }
+bool DecodeJob::done() const
+{
+    return impl_->done();
+}
 
-    const int16_t * data = &buffer_[0];
-    size_t size = buffer_.size();
-    return Buffer(reinterpret_cast<const char*>(data), size * 2);
+const Buffer & DecodeJob::result() const
+{
+    return impl_->result();
 }
 
 }
@@ -0,0 +1,299 @@
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <s3eSound.h>
+
+#include "audio/Memory.h"
+
+#include "audio/Effect.h"
+
+namespace audio {
+
+namespace {
+
+const float pi = 3.14159265f;
+// Reverb line lengths at 44100Hz, right channel lines are longer by reverbSpread.
+const size_t combSizes[] = { 1116, 1188, 1277, 1356 };
+const size_t allpassSizes[] = { 556, 441 };
+const size_t reverbSpread = 23;
+const int referenceRate = 44100;
+// Level where tail is considered died out, relative to 0x100.
+const int tailThreshold = 0x100 * 1000;
+
+inline int clamp16(int v)
+{
+    typedef std::numeric_limits<int16_t> limits;
+    if(v < limits::min())
+        return limits::min();
+    if(v > limits::max())
+        return limits::max();
+    return v;
+}
+
+// Number of feedback rounds until level drops by 60dB.
+size_t decayRounds(int feedback)
+{
+    size_t rounds = 1;
+    for(int level = tailThreshold; level > 0x100 && rounds < 0x100; ++rounds)
+        level = level * feedback / 0x100;
+    return rounds;
+}
+
+int16_t * allocateLine(size_t size)
+{
+    int16_t * result = static_cast<int16_t*>(allocate(size * 2, memoryEffects));
+    memset(result, 0, size * 2);
+    return result;
+}
+
+}
+
+bool Effect::run(int16_t * data, size_t frames, int channels, bool silent)
+{
+    if(bypass_)
+        return !silent;
+    if(!silent)
+    {
+        silentFrames_ = 0;
+        process(data, frames, channels);
+        return true;
+    }
+
+    size_t tailFrames = tail();
+    if(silentFrames_ >= tailFrames)
+        return false;
+    process(data, frames, channels);
+    silentFrames_ += frames;
+    if(silentFrames_ >= tailFrames)
+        reset();
+    return true;
+}
+
+bool EffectChain::idle() const
+{
+    for(size_t i = 0; i != size; ++i)
+        if(!effects[i]->idle())
+            return false;
+    return true;
+}
+
+bool EffectChain::run(int16_t * data, size_t frames, int channels, bool silent)
+{
+    bool active = !silent;
+    for(size_t i = 0; i != size; ++i)
+        active = effects[i]->run(data, frames, channels, !active);
+    return active;
+}
+
+BiquadFilter::BiquadFilter(BiquadType type, int frequency, float q)
+    : type_(type), rate_(s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ)), q_(q), frequency_(frequency), dirty_(0)
+{
+    update();
+    reset();
+}
+
+void BiquadFilter::frequency(int value)
+{
+    frequency_ = value;
+    dirty_ = 1;
+}
+
+void BiquadFilter::update()
+{
+    int frequency = frequency_;
+    float w0 = 2 * pi * std::max(1, std::min(frequency, rate_ / 2 - 1)) / rate_;
+    float cosw0 = cosf(w0);
+    float alpha = sinf(w0) / (2 * q_);
+    float a0 = 1 + alpha;
+
+    float b1 = type_ == biquadLowPass ? 1 - cosw0 : -(1 + cosw0);
+    float b0 = (type_ == biquadLowPass ? 1 - cosw0 : 1 + cosw0) / 2;
+    coefficients_.b0 = b0 / a0;
+    coefficients_.b1 = b1 / a0;
+    coefficients_.b2 = b0 / a0;
+    coefficients_.a1 = -2 * cosw0 / a0;
+    coefficients_.a2 = (1 - alpha) / a0;
+}
+
+void BiquadFilter::process(int16_t * data, size_t frames, int channels)
+{
+    if(dirty_)
+    {
+        dirty_ = 0;
+        update();
+    }
+
+    Coefficients c = coefficients_;
+    for(int ch = 0; ch != channels; ++ch)
+    {
+        float x1 = state_[ch][0], x2 = state_[ch][1], y1 = state_[ch][2], y2 = state_[ch][3];
+        int16_t * p = data + ch;
+        for(size_t i = 0; i != frames; ++i, p += channels)
+        {
+            float x = *p;
+            float y = c.b0 * x + c.b1 * x1 + c.b2 * x2 - c.a1 * y1 - c.a2 * y2;
+            x2 = x1;
+            x1 = x;
+            y2 = y1;
+            y1 = y;
+            *p = static_cast<int16_t>(clamp16(static_cast<int>(y)));
+        }
+        state_[ch][0] = x1;
+        state_[ch][1] = x2;
+        state_[ch][2] = y1;
+        state_[ch][3] = y2;
+    }
+}
+
+size_t BiquadFilter::tail() const
+{
+    return rate_ / 100;
+}
+
+void BiquadFilter::reset()
+{
+    memset(state_, 0, sizeof(state_));
+}
+
+Delay::Delay(int delayMs, int feedback, int wet)
+    : frames_(std::max(1, s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ) * delayMs / 1000)),
+      feedback_(std::min(feedback, 0xff)), wet_(wet), pos_(0)
+{
+    for(int ch = 0; ch != 2; ++ch)
+        lines_[ch] = allocateLine(frames_);
+}
+
+Delay::~Delay()
+{
+    for(int ch = 0; ch != 2; ++ch)
+        deallocate(lines_[ch]);
+}
+
+void Delay::process(int16_t * data, size_t frames, int channels)
+{
+    size_t pos = pos_;
+    for(int ch = 0; ch != channels; ++ch)
+    {
+        int16_t * line = lines_[ch];
+        int16_t * p = data + ch;
+        pos = pos_;
+        for(size_t i = 0; i != frames; ++i, p += channels)
+        {
+            int in = *p;
+            int delayed = line[pos];
+            line[pos] = static_cast<int16_t>(clamp16(in + delayed * feedback_ / 0x100));
+            *p = static_cast<int16_t>(clamp16(in + delayed * wet_ / 0x100));
+            if(++pos == frames_)
+                pos = 0;
+        }
+    }
+    pos_ = pos;
+}
+
+size_t Delay::tail() const
+{
+    return frames_ * decayRounds(feedback_);
+}
+
+void Delay::reset()
+{
+    for(int ch = 0; ch != 2; ++ch)
+        memset(lines_[ch], 0, frames_ * 2);
+    pos_ = 0;
+}
+
+Reverb::Reverb(int roomSize, int damping, int wet)
+    : feedback_(0xb3 + roomSize * 0x48 / 0x100), damping_(damping), wet_(wet)
+{
+    int rate = s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ);
+    for(int ch = 0; ch != 2; ++ch)
+    {
+        size_t spread = ch ? reverbSpread : 0;
+        for(int i = 0; i != combs; ++i)
+        {
+            Line & line = combs_[ch][i];
+            line.size = std::max<size_t>(1, (combSizes[i] + spread) * rate / referenceRate);
+            line.data = allocateLine(line.size);
+            line.pos = 0;
+            line.filter = 0;
+        }
+        for(int i = 0; i != allpasses; ++i)
+        {
+            Line & line = allpasses_[ch][i];
+            line.size = std::max<size_t>(1, (allpassSizes[i] + spread) * rate / referenceRate);
+            line.data = allocateLine(line.size);
+            line.pos = 0;
+            line.filter = 0;
+        }
+    }
+}
+
+Reverb::~Reverb()
+{
+    for(int ch = 0; ch != 2; ++ch)
+    {
+        for(int i = 0; i != combs; ++i)
+            deallocate(combs_[ch][i].data);
+        for(int i = 0; i != allpasses; ++i)
+            deallocate(allpasses_[ch][i].data);
+    }
+}
+
+void Reverb::process(int16_t * data, size_t frames, int channels)
+{
+    int feedback = feedback_;
+    int damping = damping_;
+    for(int ch = 0; ch != channels; ++ch)
+    {
+        int16_t * p = data + ch;
+        for(size_t i = 0; i != frames; ++i, p += channels)
+        {
+            int in = *p / combs;
+            int out = 0;
+            for(int c = 0; c != combs; ++c)
+            {
+                Line & line = combs_[ch][c];
+                int delayed = line.data[line.pos];
+                out += delayed;
+                line.filter = (delayed * (0x100 - damping) + line.filter * damping) / 0x100;
+                line.data[line.pos] = static_cast<int16_t>(clamp16(in + line.filter * feedback / 0x100));
+                if(++line.pos == line.size)
+                    line.pos = 0;
+            }
+            for(int a = 0; a != allpasses; ++a)
+            {
+                Line & line = allpasses_[ch][a];
+                int delayed = line.data[line.pos];
+                line.data[line.pos] = static_cast<int16_t>(clamp16(out + delayed / 2));
+                out = delayed - out;
+                if(++line.pos == line.size)
+                    line.pos = 0;
+            }
+            *p = static_cast<int16_t>(clamp16(*p + out * wet_ / 0x100));
+        }
+    }
+}
+
+size_t Reverb::tail() const
+{
+    return combs_[1][combs - 1].size * decayRounds(feedback_);
+}
+
+void Reverb::reset()
+{
+    for(int ch = 0; ch != 2; ++ch)
+    {
+        for(int i = 0; i != combs; ++i)
+        {
+            memset(combs_[ch][i].data, 0, combs_[ch][i].size * 2);
+            combs_[ch][i].filter = 0;
+        }
+        for(int i = 0; i != allpasses; ++i)
+            memset(allpasses_[ch][i].data, 0, allpasses_[ch][i].size * 2);
+    }
+}
+
+}
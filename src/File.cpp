@@ -0,0 +1,48 @@
+#include <s3eDebug.h>
+#include <s3eSound.h>
+
+#include "audio/OggFile.h"
+#include "audio/RawFile.h"
+#include "audio/Utils.h"
+#include "audio/WavFile.h"
+
+#include "audio/File.h"
+
+namespace audio {
+
+namespace {
+
+bool isOgg(const Buffer & data)
+{
+    return data.size() >= 4 && !memcmp(data.data(), "OggS", 4);
+}
+
+}
+
+File * openFile(const Buffer & data, int rawRate)
+{
+    if(WavFile::detect(data))
+    {
+        WavFile * result = new WavFile(data);
+        if(result->valid())
+            return result;
+        delete result;
+        return 0;
+    }
+    if(isOgg(data))
+        return new OggFile(data);
+    return new RawFile(data, rawRate ? rawRate : s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ));
+}
+
+File * openFile(const char * fname, int rawRate)
+{
+    Buffer data = loadFile(fname);
+    if(data.empty())
+    {
+        s3eDebugTracePrintf("audio::openFile, cannot load %s", fname);
+        return 0;
+    }
+    return openFile(data, rawRate);
+}
+
+}
@@ -1,82 +1,170 @@
 #include <s3eSound.h>
 #include <s3eThread.h>
+#include <s3eTimer.h>
 
 #include <IwDebug.h>
 
 #include <algorithm>
+#include <vector>
 
 #include "audio/OnFlyDecoder.h"
 #include "audio/Buffer.h"
+#include "audio/Effect.h"
+#include "audio/Pool.h"
+#include "audio/Trace.h"
 #include "audio/Utils.h"
 
 #include "audio/Manager.h"
 
 namespace audio {
 
-int audiostep = 0x100;
-
 namespace {
 
-const size_t limit = 0x20;
+const size_t limit = maxVoices;
+const int maxCoalescedGain = 0x400;
+// Finished voices wait in delete queue, so pool has room for two generations.
+const size_t sourcePoolSize = limit * 2;
+// Voices and buses are processed in blocks of this size when they are mixed separately.
+const size_t busBlockSize = maxBlockFrames;
+// Cleared effects are deleted once this many callbacks started since.
+const int retireCallbacks = 2;
+// Upper bound for stop handshake, in 1ms steps, in case output is already dead.
+const int stopWaitSteps = 200;
 
 class BufferSource : public Source {
 public:
     explicit BufferSource(bool owned, const Buffer & buffer)
-        : Source(owned), buffer_(buffer), pos_(0)
+        : Source(owned), buffer_(buffer), pos_(0), phase_(0), rate_(normalRate), volume_(0x100)
+    {
+    }
+
+    static void * operator new(size_t size)
+    {
+        return pool().allocate(size);
+    }
+
+    static void operator delete(void * data)
     {
+        pool().deallocate(data);
     }
 
     bool pollable() { return false; }
+
+    void volume(int value)
+    {
+        volume_ = value;
+    }
+
+    void playbackRate(int value)
+    {
+        rate_ = clampRate(value);
+    }
     
     int mix(int16_t * out, int limit)
     {
         int left = buffer_.size() / 2 - pos_;
-        if(!left)
+        int16_t * data = reinterpret_cast<int16_t*>(buffer_.data()) + pos_;
+        int rate = rate_;
+        if(rate != normalRate || phase_)
+        {
+            size_t consumed = 0;
+            int result = left > 0 ? audio::mixResampled(out, data, left, phase_, rate, volume_, limit, consumed) : 0;
+            pos_ += consumed;
+            return result ? result : -1;
+        }
+
+        if(left <= 0)
             return -1;
         int result = std::min<int>(limit, left);
-        audio::mix(true, out, reinterpret_cast<int16_t*>(buffer_.data()) + pos_, 0x100, result);
+        audio::mix(true, out, data, volume_, result);
         pos_ += result;
         return result;
     }
+
+    int skip(int limit)
+    {
+        int left = buffer_.size() / 2 - pos_;
+        if(left <= 0)
+            return -1;
+        uint64_t advance = static_cast<uint64_t>(limit) * static_cast<uint32_t>(rate_) + phase_;
+        int frames = static_cast<int>(std::min<uint64_t>(advance >> 16, left));
+        pos_ += frames;
+        phase_ = static_cast<uint32_t>(advance & 0xffff);
+        return limit;
+    }
+
+    int position() const
+    {
+        return pos_;
+    }
 private:
     Buffer buffer_;
     int pos_;
-};
+    uint32_t phase_;
+    volatile int rate_;
+    volatile int volume_;
 
-void * myMalloc(int size)
-{
-    if(size >= 0x40000 || size < 0)
+    static ObjectPool<BufferSource, sourcePoolSize> & pool()
     {
-        memset(reinterpret_cast<void*>(audiostep), 0, 0x1000);
+        static ObjectPool<BufferSource, sourcePoolSize> result;
+        return result;
     }
-    return atomics.malloc(size);
-}
+};
 
-void * myRealloc(void* item, int size)
-{
-    if(size >= 0x40000 || size < 0)
-    {
-        memset(reinterpret_cast<void*>(audiostep), 0, 0x1000);
-    }
-    return atomics.realloc(item, size);
-}
+struct InstanceRule {
+    Buffer sample;
+    int instances;
+    InstancePolicy policy;
+    uint64 window;
+};
 
-void myFree(void* item)
-{
-    atomics.free(item);
-}
+// Per callback state of one voice on audio thread.
+struct VoiceMix {
+    int result;
+    bool positional;
+    bool culled;
+    int left;
+    int right;
+    EffectChain effects;
+};
 
-s3eMemoryUsrMgr mm = { myMalloc, myRealloc, myFree };
+struct RetiredEffect {
+    Effect * effect;
+    int callback;
+};
+
+// Game thread record of voice started by play(const Buffer &).
+struct Voice {
+    Source * source;
+    const char * sample;
+    uint64 started;
+    int gain;
+};
 
 }
 
 class Manager::Impl {
 public:
     Impl()
-        : channel_(-1), lock_(0), sourcesSize_(0), delSize_(0), pollSize_(0),
+        : channel_(-1), lock_(0), sourcesSize_(0), delSize_(0), pollSize_(0), voicesSize_(0),
+          nextId_(0), snapshotSeq_(0), snapshotSize_(0), finishCallback_(0), finishData_(0),
+          metering_(0), busesActive_(0), stereo_(false), stereoRegistered_(false), callbacks_(0), blockFrames_(0),
+          queueCallbacks_(1), inCallback_(0), stopping_(0), stopAck_(0),
           osid_((s3eDeviceOSID)s3eDeviceGetInt(S3E_DEVICE_OS))
     {
         atomicsGetTable(atomics);
+        for(int i = 0; i != busCount; ++i)
+        {
+            busVolume_[i] = 0x100;
+            busEffects_[i].size = 0;
+        }
+        memset(&meters_, 0, sizeof(meters_));
+        memset(&pendingMeters_, 0, sizeof(pendingMeters_));
+        memset(&latency_, 0, sizeof(latency_));
+        latency_.triggerUs = latency_.maxTriggerUs = -1;
+        memset(&listener_, 0, sizeof(listener_));
+        listener_.right.x = 1;
+        mixListener_ = listener_;
         s3eDebugTracePrintf("audio create");
     }
 
@@ -85,13 +173,14 @@ public:
         stop(true);
 
         for(size_t i = 0; i != sourcesSize_; ++i)
+        {
+            retireEffects(sources_[i]->effects_);
             if(sources_[i]->owned())
                 delete sources_[i];
-
-        timespec ts;
-        ts.tv_sec = 1;
-        ts.tv_nsec = 0;
-        atomics.nanosleep(&ts, 0);
+        }
+        for(int i = 0; i != busCount; ++i)
+            retireEffects(busEffects_[i]);
+        deleteRetired();
     }
 
     void start()
@@ -101,8 +190,13 @@ public:
         processDelQueue();
         if(channel_ == -1)
         {
+            atomicsWrite(&stopping_, 0);
             channel_ = s3eSoundGetFreeChannel();
+            latency_.outputRate = s3eSoundGetInt(S3E_SOUND_OUTPUT_FREQ);
             s3eSoundChannelRegister(channel_, S3E_CHANNEL_GEN_AUDIO, &Impl::genAudio, this);
+            stereoRegistered_ = stereo_ && s3eSoundGetInt(S3E_SOUND_STEREO_ENABLED);
+            if(stereoRegistered_)
+                s3eSoundChannelRegister(channel_, S3E_CHANNEL_GEN_AUDIO_STEREO, &Impl::genAudio, this);
 
             int16 dummy[8];
             memset(dummy, 0, sizeof(dummy));
@@ -119,16 +213,16 @@ public:
         
         if(channel_ != -1)
         {
-            s3eSoundChannelUnRegister(channel_, S3E_CHANNEL_GEN_AUDIO);
+            atomicsWrite(&stopAck_, 0);
+            atomicsWrite(&stopping_, 1);
             s3eSoundChannelStop(channel_);
+            s3eSoundChannelUnRegister(channel_, S3E_CHANNEL_GEN_AUDIO);
+            if(stereoRegistered_)
+                s3eSoundChannelUnRegister(channel_, S3E_CHANNEL_GEN_AUDIO_STEREO);
+            stereoRegistered_ = false;
             if(waitStop)
-                for(int j = 0; j != 1000 && s3eSoundChannelGetInt(channel_, S3E_CHANNEL_STATUS); ++j)
-                {
-                    timespec ts;
-                    ts.tv_sec = 0;
-                    ts.tv_nsec = 10000000;
-                    atomics.nanosleep(&ts, 0);
-                }
+                waitCallback();
+            // Stays set until start, a late callback only outputs silence.
             channel_ = -1;
         }
 
@@ -157,19 +251,225 @@ public:
     Source * play(const Buffer & sample)
     {
         processDelQueue();
+
+        const InstanceRule * rule = findRule(sample);
+        if(rule)
+        {
+            uint64 now = s3eTimerGetMs();
+            size_t count = 0;
+            Voice * oldest = 0;
+            Voice * newest = 0;
+            for(size_t i = 0; i != voicesSize_; ++i)
+                if(voices_[i].sample == sample.data())
+                {
+                    ++count;
+                    if(!oldest || voices_[i].started < oldest->started)
+                        oldest = &voices_[i];
+                    if(!newest || voices_[i].started >= newest->started)
+                        newest = &voices_[i];
+                }
+
+            if(rule->policy == instanceCoalesce && newest && now - newest->started <= rule->window)
+            {
+                newest->gain = std::min(newest->gain + 0x100, maxCoalescedGain);
+                newest->source->volume(newest->gain);
+                return newest->source;
+            }
+
+            if(count >= static_cast<size_t>(rule->instances))
+            {
+                if(rule->policy == instanceReject)
+                    return 0;
+                processDelQueue(oldest->source);
+            }
+        }
+
         if(sourcesSize_ < limit)
         {
             Source * result = new BufferSource(true, sample);
+            Voice & voice = voices_[voicesSize_++];
+            voice.source = result;
+            voice.sample = sample.data();
+            voice.started = s3eTimerGetMs();
+            voice.gain = 0x100;
             appendSource(result);
             return result;
         } else
             return 0;
     }
 
+    void limitInstances(const Buffer & sample, int instances, InstancePolicy policy, int window)
+    {
+        std::vector<InstanceRule>::iterator i = rules_.begin(), end = rules_.end();
+        for(; i != end && i->sample.data() != sample.data(); ++i)
+            ;
+        if(i != end)
+            rules_.erase(i);
+
+        if(instances > 0)
+        {
+            InstanceRule rule;
+            rule.sample = sample;
+            rule.instances = instances;
+            rule.policy = policy;
+            rule.window = window;
+            rules_.push_back(rule);
+        }
+    }
+
     void poll()
     {
+        processDelQueue();
+
         for(size_t i = 0; i != pollSize_; ++i)
             polls_[i]->poll();
+
+        lock(1);
+        for(size_t i = 0; i != sourcesSize_; ++i)
+        {
+            sources_[i]->mixPositional_ = sources_[i]->positional_;
+            sources_[i]->mixEmitter_ = sources_[i]->emitter_;
+        }
+        mixListener_ = listener_;
+        unlock(1);
+
+        deleteRetired();
+
+        if(!finished_.empty())
+        {
+            if(finishCallback_)
+                for(std::vector<unsigned>::iterator i = finished_.begin(), end = finished_.end(); i != end; ++i)
+                    finishCallback_(*i, finishData_);
+            finished_.clear();
+        }
+    }
+
+    size_t voices(VoiceSnapshot * out, size_t capacity)
+    {
+        for(;;)
+        {
+            int seq = atomics.cas(&snapshotSeq_, 0, 0);
+            if(seq & 1)
+            {
+                atomics.sched_yield();
+                continue;
+            }
+            size_t published = snapshotSize_;
+            size_t size = std::min(published, capacity);
+            memcpy(out, snapshot_, size * sizeof(*out));
+            if(atomics.cas(&snapshotSeq_, 0, 0) == seq)
+                return size;
+        }
+    }
+
+    void stereo(bool enabled)
+    {
+        IwAssertMsg(AUDIO_MANAGER, channel_ == -1, ("stereo on started audio manager"));
+        stereo_ = enabled;
+    }
+
+    void listener(const Listener & value)
+    {
+        listener_ = value;
+    }
+
+    void emitter(Source * source, const Emitter & value)
+    {
+        source->emitter_ = value;
+        source->positional_ = true;
+    }
+
+    void addEffect(Source * source, Effect * effect)
+    {
+        addEffect(source->effects_, effect);
+    }
+
+    void addEffect(int bus, Effect * effect)
+    {
+        IwAssertMsg(AUDIO_MANAGER, bus >= 0 && bus < busCount, ("Invalid bus: %d", bus));
+        addEffect(busEffects_[bus], effect);
+    }
+
+    void clearEffects(Source * source)
+    {
+        clearEffects(source->effects_);
+    }
+
+    void clearEffects(int bus)
+    {
+        IwAssertMsg(AUDIO_MANAGER, bus >= 0 && bus < busCount, ("Invalid bus: %d", bus));
+        clearEffects(busEffects_[bus]);
+    }
+
+    void bus(Source * source, int bus)
+    {
+        source->bus_ = std::max(0, std::min(bus, busCount - 1));
+    }
+
+    void busVolume(int bus, int value)
+    {
+        IwAssertMsg(AUDIO_MANAGER, bus >= 0 && bus < busCount, ("Invalid bus: %d", bus));
+        busVolume_[bus] = value;
+        int active = 0;
+        for(int i = 0; i != busCount; ++i)
+            active |= busVolume_[i] != 0x100;
+        busesActive_ = active;
+    }
+
+    void metering(bool enabled)
+    {
+        metering_ = enabled;
+    }
+
+    bool meters(MeterSnapshot & out)
+    {
+        if(!metering_)
+            return false;
+        for(;;)
+        {
+            int seq = atomics.cas(&snapshotSeq_, 0, 0);
+            if(seq & 1)
+            {
+                atomics.sched_yield();
+                continue;
+            }
+            out = meters_;
+            if(atomics.cas(&snapshotSeq_, 0, 0) == seq)
+                return true;
+        }
+    }
+
+    void blockSize(int frames)
+    {
+        blockFrames_ = std::max(0, std::min(frames, maxBlockFrames));
+    }
+
+    void outputQueue(int callbacks)
+    {
+        queueCallbacks_ = std::max(1, callbacks);
+    }
+
+    void latency(LatencyInfo & out)
+    {
+        for(;;)
+        {
+            int seq = atomics.cas(&snapshotSeq_, 0, 0);
+            if(seq & 1)
+            {
+                atomics.sched_yield();
+                continue;
+            }
+            out = latency_;
+            if(atomics.cas(&snapshotSeq_, 0, 0) == seq)
+                break;
+        }
+        out.blockFrames = blockFrames_ ? blockFrames_ : maxBlockFrames;
+    }
+
+    void onFinish(FinishCallback callback, void * userData)
+    {
+        finishCallback_ = callback;
+        finishData_ = userData;
     }
 private:
     void lock(int id)
@@ -184,6 +484,74 @@ private:
         IwAssertMsg(AUDIO_MANAGER, res == id, ("Invalid lock state: %d", res));
     }
     
+    const InstanceRule * findRule(const Buffer & sample) const
+    {
+        for(std::vector<InstanceRule>::const_iterator i = rules_.begin(), end = rules_.end(); i != end; ++i)
+            if(i->sample.data() == sample.data())
+                return &*i;
+        return 0;
+    }
+
+    void addEffect(EffectChain & chain, Effect * effect)
+    {
+        IwAssertMsg(AUDIO_MANAGER, chain.size < maxEffects, ("Too many effects"));
+        if(chain.size == maxEffects)
+        {
+            delete effect;
+            return;
+        }
+        lock(1);
+        chain.effects[chain.size] = effect;
+        ++chain.size;
+        unlock(1);
+    }
+
+    void clearEffects(EffectChain & chain)
+    {
+        EffectChain cleared;
+        lock(1);
+        cleared = chain;
+        chain.size = 0;
+        unlock(1);
+        retireEffects(cleared);
+    }
+
+    // Audio thread may still run effects copied by current callback, so they
+    // are deleted only after following callbacks started.
+    void retireEffects(EffectChain & chain)
+    {
+        int callback = atomics.cas(&callbacks_, 0, 0);
+        for(size_t i = 0; i != chain.size; ++i)
+        {
+            RetiredEffect retired = { chain.effects[i], callback };
+            retired_.push_back(retired);
+        }
+        chain.size = 0;
+    }
+
+    void deleteRetired()
+    {
+        int callback = atomics.cas(&callbacks_, 0, 0);
+        bool stopped = channel_ == -1;
+        std::vector<RetiredEffect>::iterator out = retired_.begin();
+        for(std::vector<RetiredEffect>::iterator i = retired_.begin(), end = retired_.end(); i != end; ++i)
+            if(stopped || callback - i->callback >= retireCallbacks)
+                delete i->effect;
+            else
+                *out++ = *i;
+        retired_.erase(out, retired_.end());
+    }
+
+    void removeVoice(Source * source)
+    {
+        for(size_t i = 0; i != voicesSize_; ++i)
+            if(voices_[i].source == source)
+            {
+                voices_[i] = voices_[--voicesSize_];
+                break;
+            }
+    }
+
     static int32 processDelQueueCB(void * system, void * user)
     {
         static_cast<Impl*>(user)->processDelQueue();
@@ -192,6 +560,7 @@ private:
 
     void processDelQueue(Source * source = 0)
     {
+        AUDIO_TRACE_SCOPE("Manager::processDelQueue");
         size_t size;
         Source * queue[limit + 1];
         lock(1);
@@ -202,7 +571,12 @@ private:
             removeSource(source);
         unlock(1);
         
-        if(source)
+        for(size_t i = 0; i != size; ++i)
+            finished_.push_back(queue[i]->id());
+
+        // The audio thread may have finished the source already, it is
+        // deleted once either way.
+        if(source && std::find(queue, queue + size, source) == queue + size)
             queue[size++] = source;
         // TODO owned cannot be mixed with pollable
 
@@ -214,6 +588,8 @@ private:
             size_t idx = std::find(polls_, polls_ + pollSize_, queue[i]) - polls_;
             if(idx != pollSize_)
                 deletedIndicies[deletedPolls++] = idx;
+            removeVoice(queue[i]);
+            retireEffects(queue[i]->effects_);
             if(queue[i]->owned())
                 delete queue[i];
         }
@@ -230,6 +606,12 @@ private:
     {
         bool pollable = source->pollable();
         size_t size = 0;
+        if(!++nextId_)
+            ++nextId_;
+        source->id_ = nextId_;
+        source->mixPositional_ = source->positional_;
+        source->mixEmitter_ = source->emitter_;
+        source->triggered_ = s3eTimerGetUSTNanoseconds();
         lock(1);
         sources_[size = sourcesSize_++] = source;
         unlock(1);
@@ -237,39 +619,187 @@ private:
             polls_[pollSize_++] = source;
     }
 
+    // Callback acknowledges stop request, after that and once no callback is
+    // running nothing touches sources. Normally takes at most one callback period.
+    void waitCallback()
+    {
+        for(int i = 0; i != stopWaitSteps; ++i)
+        {
+            bool idle = !atomics.cas(&inCallback_, 0, 0);
+            if(idle && (atomics.cas(&stopAck_, 0, 0) || !s3eSoundChannelGetInt(channel_, S3E_CHANNEL_STATUS)))
+                return;
+            timespec ts;
+            ts.tv_sec = 0;
+            ts.tv_nsec = 1000000;
+            atomics.nanosleep(&ts, 0);
+        }
+        s3eDebugTracePrintf("audio::Manager::stop, callback did not acknowledge stop");
+    }
+
     static int32 genAudio(void* systemData, void* userData)
     {
-        return static_cast<Impl*>(userData)->doGenAudio(static_cast<s3eSoundGenAudioInfo*>(systemData));
+        Impl * impl = static_cast<Impl*>(userData);
+        s3eSoundGenAudioInfo * info = static_cast<s3eSoundGenAudioInfo*>(systemData);
+
+        atomics.add(&impl->inCallback_, 1);
+        int32 result;
+        if(atomics.cas(&impl->stopping_, 0, 0))
+        {
+            if(!info->m_Mix)
+                memset(info->m_Target, 0, info->m_NumSamples * (info->m_Stereo ? 4 : 2));
+            atomicsWrite(&impl->stopAck_, 1);
+            result = 0;
+        } else
+            result = impl->doGenAudio(info);
+        atomics.add(&impl->inCallback_, -1);
+        return result;
     }
 
     int32 doGenAudio(s3eSoundGenAudioInfo * info)
     {
+        AUDIO_TRACE_CALLBACK_SCOPE("Manager::genAudio");
+        atomics.add(&callbacks_, 1);
+        uint64 now = s3eTimerGetUSTNanoseconds();
         size_t size;
         Source * sources[limit];
+        Listener listener;
+        size_t positionalSize = 0;
+        size_t positional[limit];
+        Emitter emitters[limit];
+        VoiceMix mixes[limit];
+        EffectChain busEffects[busCount];
+        bool effects = false;
         {
             lock(2);
             size = sourcesSize_;
             memcpy(sources, sources_, size * sizeof(*sources));
+            listener = mixListener_;
+            for(size_t i = 0; i != size; ++i)
+                if(sources[i]->mixPositional_)
+                {
+                    emitters[positionalSize] = sources[i]->mixEmitter_;
+                    positional[positionalSize++] = i;
+                }
+            for(size_t i = 0; i != size; ++i)
+            {
+                mixes[i].effects = sources[i]->effects_;
+                effects = effects || mixes[i].effects.size;
+            }
+            for(int b = 0; b != busCount; ++b)
+            {
+                busEffects[b] = busEffects_[b];
+                effects = effects || busEffects[b].size;
+            }
             unlock(2);
         }
 
+        bool stereo = info->m_Stereo != 0;
         if(!info->m_Mix)
-            memset(info->m_Target, 0, info->m_NumSamples * 2);
+            memset(info->m_Target, 0, info->m_NumSamples * (stereo ? 4 : 2));
 
         size_t delSize = 0;
         Source * del[limit];
+        VoiceSnapshot snapshot[limit];
 
-        int result = 0;
         for(size_t i = 0; i != size; ++i)
         {
-            int current = sources[i]->mix(info->m_Target, info->m_NumSamples);
-            if(current == -1)
+            VoiceMix & mix = mixes[i];
+            mix.result = 0;
+            mix.positional = mix.culled = false;
+            mix.left = mix.right = 0x100;
+        }
+
+        if(positionalSize)
+        {
+            int left[limit];
+            int right[limit];
+            spatialize(listener, emitters, positionalSize, stereo, left, right);
+            for(size_t j = 0; j != positionalSize; ++j)
             {
+                VoiceMix & mix = mixes[positional[j]];
+                mix.positional = true;
+                mix.left = left[j];
+                mix.right = right[j];
+                if(!left[j] && !right[j])
+                {
+                    mix.culled = true;
+                    mix.result = sources[positional[j]]->skip(info->m_NumSamples);
+                }
+            }
+        }
+
+        bool metering = metering_ != 0;
+        size_t blockFrames = blockFrames_ ? blockFrames_ : busBlockSize;
+        if(metering || busesActive_ || stereo || positionalSize || effects)
+            mixBuses(sources, size, info->m_Target, info->m_NumSamples, blockFrames,
+                     stereo, metering, mixes, busEffects, snapshot);
+        else
+        {
+            size_t samples = info->m_NumSamples;
+            for(size_t offset = 0; offset < samples; offset += blockFrames)
+            {
+                size_t block = std::min(blockFrames, samples - offset);
+                for(size_t i = 0; i != size; ++i)
+                {
+                    if(mixes[i].result == -1)
+                        continue;
+                    AUDIO_TRACE_CALLBACK_SCOPE("Source::mix");
+                    int current = sources[i]->mix(info->m_Target + offset, block);
+                    mixes[i].result = current == -1 ? -1 : std::max(mixes[i].result, current);
+                }
+            }
+        }
+
+        // Output of this callback is queued behind the ones being played, so
+        // it is heard about queueCallbacks_ callbacks later.
+        int rate = latency_.outputRate ? latency_.outputRate : 1;
+        int queueCallbacks = queueCallbacks_;
+        uint64 heard = now + static_cast<uint64>(info->m_NumSamples) * queueCallbacks * 1000000000 / rate;
+        int triggerUs = -1;
+        for(size_t i = 0; i != size; ++i)
+            if(sources[i]->triggered_ && mixes[i].result > 0 && !mixes[i].culled)
+            {
+                uint64 triggered = std::min<uint64>(sources[i]->triggered_, heard);
+                triggerUs = std::max(triggerUs, static_cast<int>((heard - triggered) / 1000));
+                sources[i]->triggered_ = 0;
+            }
+
+        for(size_t i = 0; i != size; ++i)
+        {
+            int current = mixes[i].result;
+            if(current == -1)
                 del[delSize++] = sources[i];
-            } else
-                result = std::max(result, current);
+
+            VoiceSnapshot & voice = snapshot[i];
+            voice.id = sources[i]->id();
+            if(current == -1)
+                voice.state = voiceFinished;
+            else if(mixes[i].culled)
+                voice.state = voiceCulled;
+            else
+                voice.state = current ? voicePlaying : voiceStarving;
+            voice.position = sources[i]->position();
+            // Levels of metered voices are filled by mixBuses.
+            if(!metering || current <= 0 || mixes[i].culled)
+                voice.peak = voice.rms = 0;
         }
 
+        atomics.add(&snapshotSeq_, 1);
+        memcpy(snapshot_, snapshot, size * sizeof(snapshot[0]));
+        snapshotSize_ = size;
+        if(metering)
+            meters_ = pendingMeters_;
+        latency_.callbackFrames = info->m_NumSamples;
+        latency_.maxCallbackFrames = std::max<int>(latency_.maxCallbackFrames, info->m_NumSamples);
+        latency_.callbackUs = static_cast<int>(static_cast<uint64>(info->m_NumSamples) * 1000000 / rate);
+        latency_.queueCallbacks = queueCallbacks;
+        if(triggerUs >= 0)
+        {
+            latency_.triggerUs = triggerUs;
+            latency_.maxTriggerUs = std::max(latency_.maxTriggerUs, triggerUs);
+        }
+        atomics.add(&snapshotSeq_, 1);
+
         if(delSize)
         {
             lock(2);
@@ -284,6 +814,114 @@ private:
         return info->m_NumSamples;
     }
 
+    // Mixes every voice to its bus and buses to output in blocks, running
+    // effects, applying positional gains and measuring levels on the way when
+    // metering is on. Voice levels are measured after voice effects and before
+    // positional gains. Culled voices are skipped. Fills results of mixes and
+    // rms of snapshot, bus and master measurements go to pendingMeters_.
+    void mixBuses(Source ** sources, size_t size, int16_t * target, size_t samples, size_t blockFrames,
+                  bool stereo, bool metering, VoiceMix * mixes, EffectChain * busEffects, VoiceSnapshot * snapshot)
+    {
+        size_t channels = stereo ? 2 : 1;
+        int64_t voiceSquares[limit];
+        int voicePeaks[limit];
+        int64_t busSquares[busCount];
+        int busPeaks[busCount];
+        int64_t masterSquares = 0;
+        int masterPeak = 0;
+        bool busUsed[busCount];
+
+        for(size_t i = 0; i != size; ++i)
+        {
+            voiceSquares[i] = 0;
+            voicePeaks[i] = 0;
+        }
+        for(int b = 0; b != busCount; ++b)
+        {
+            busSquares[b] = 0;
+            busPeaks[b] = 0;
+        }
+
+        for(size_t offset = 0; offset < samples; offset += blockFrames)
+        {
+            size_t block = std::min(blockFrames, samples - offset);
+            for(int b = 0; b != busCount; ++b)
+                busUsed[b] = false;
+
+            for(size_t i = 0; i != size; ++i)
+            {
+                VoiceMix & voice = mixes[i];
+                if(voice.result == -1 || voice.culled)
+                    continue;
+                int b = sources[i]->bus_;
+                if(!busUsed[b])
+                {
+                    memset(busBuffer_[b], 0, block * channels * 2);
+                    busUsed[b] = true;
+                }
+
+                AUDIO_TRACE_CALLBACK_SCOPE("Source::mix");
+                int current;
+                if(metering || stereo || voice.positional || voice.effects.size)
+                {
+                    memset(voiceBuffer_, 0, block * 2);
+                    current = sources[i]->mix(voiceBuffer_, block);
+                    bool audible = current > 0;
+                    if(voice.effects.size)
+                        audible = voice.effects.run(voiceBuffer_, block, 1, !audible);
+                    if(audible)
+                    {
+                        if(metering)
+                            measure(voiceBuffer_, block, voicePeaks[i], voiceSquares[i]);
+                        if(stereo)
+                            mixPanned(busBuffer_[b], voiceBuffer_, voice.left, voice.right, block);
+                        else
+                            mix(true, busBuffer_[b], voiceBuffer_, voice.left, block);
+                    }
+                } else
+                    current = sources[i]->mix(busBuffer_[b], block);
+                voice.result = current == -1 ? -1 : std::max(voice.result, current);
+            }
+
+            for(int b = 0; b != busCount; ++b)
+            {
+                EffectChain & chain = busEffects[b];
+                if(!busUsed[b])
+                {
+                    if(!chain.size || chain.idle())
+                        continue;
+                    memset(busBuffer_[b], 0, block * channels * 2);
+                }
+                if(chain.size && !chain.run(busBuffer_[b], block, channels, !busUsed[b]))
+                    continue;
+                int volume = busVolume_[b];
+                if(volume != 0x100)
+                    mix(false, busBuffer_[b], busBuffer_[b], volume, block * channels);
+                if(metering)
+                    measure(busBuffer_[b], block * channels, busPeaks[b], busSquares[b]);
+                mix(true, target + offset * channels, busBuffer_[b], 0x100, block * channels);
+            }
+
+            if(metering)
+                measure(target + offset * channels, block * channels, masterPeak, masterSquares);
+        }
+
+        if(!metering)
+            return;
+        for(size_t i = 0; i != size; ++i)
+        {
+            snapshot[i].peak = voicePeaks[i];
+            snapshot[i].rms = rms(voiceSquares[i], samples);
+        }
+        for(int b = 0; b != busCount; ++b)
+        {
+            pendingMeters_.buses[b].peak = busPeaks[b];
+            pendingMeters_.buses[b].rms = rms(busSquares[b], samples * channels);
+        }
+        pendingMeters_.master.peak = masterPeak;
+        pendingMeters_.master.rms = rms(masterSquares, samples * channels);
+    }
+
     void removeSource(Source * source)
     {
         size_t idx = std::find(sources_, sources_ + sourcesSize_, source) - sources_;
@@ -301,6 +939,47 @@ private:
 
     size_t pollSize_;
     Source * polls_[limit];
+
+    size_t voicesSize_;
+    Voice voices_[limit];
+    std::vector<InstanceRule> rules_;
+
+    unsigned nextId_;
+    // Odd while audio thread writes snapshot.
+    volatile int snapshotSeq_;
+    volatile size_t snapshotSize_;
+    VoiceSnapshot snapshot_[limit];
+
+    std::vector<unsigned> finished_;
+    FinishCallback finishCallback_;
+    void * finishData_;
+
+    volatile int metering_;
+    volatile int busesActive_;
+    volatile int busVolume_[busCount];
+    // Published together with snapshot_.
+    MeterSnapshot meters_;
+    MeterSnapshot pendingMeters_;
+    bool stereo_;
+    bool stereoRegistered_;
+    Listener listener_;
+    Listener mixListener_;
+
+    volatile int callbacks_;
+    volatile int blockFrames_;
+    volatile int queueCallbacks_;
+    // Published together with snapshot_.
+    LatencyInfo latency_;
+    EffectChain busEffects_[busCount];
+    std::vector<RetiredEffect> retired_;
+
+    // Interleaved when output is stereo.
+    int16_t busBuffer_[busCount][busBlockSize * 2];
+    int16_t voiceBuffer_[busBlockSize];
+
+    volatile int inCallback_;
+    volatile int stopping_;
+    volatile int stopAck_;
     s3eDeviceOSID osid_;
 };
 
@@ -328,6 +1007,91 @@ void Manager::stop(Source * source)
     impl_->stop(source);
 }
 
+void Manager::limitInstances(const Buffer & sample, int instances, InstancePolicy policy, int window)
+{
+    impl_->limitInstances(sample, instances, policy, window);
+}
+
+size_t Manager::voices(VoiceSnapshot * out, size_t capacity) const
+{
+    return impl_->voices(out, capacity);
+}
+
+void Manager::stereo(bool enabled)
+{
+    impl_->stereo(enabled);
+}
+
+void Manager::listener(const Listener & value)
+{
+    impl_->listener(value);
+}
+
+void Manager::emitter(Source * source, const Emitter & value)
+{
+    impl_->emitter(source, value);
+}
+
+void Manager::addEffect(Source * source, Effect * effect)
+{
+    impl_->addEffect(source, effect);
+}
+
+void Manager::addEffect(int bus, Effect * effect)
+{
+    impl_->addEffect(bus, effect);
+}
+
+void Manager::clearEffects(Source * source)
+{
+    impl_->clearEffects(source);
+}
+
+void Manager::clearEffects(int bus)
+{
+    impl_->clearEffects(bus);
+}
+
+void Manager::bus(Source * source, int bus)
+{
+    impl_->bus(source, bus);
+}
+
+void Manager::busVolume(int bus, int value)
+{
+    impl_->busVolume(bus, value);
+}
+
+void Manager::metering(bool enabled)
+{
+    impl_->metering(enabled);
+}
+
+bool Manager::meters(MeterSnapshot & out) const
+{
+    return impl_->meters(out);
+}
+
+void Manager::blockSize(int frames)
+{
+    impl_->blockSize(frames);
+}
+
+void Manager::outputQueue(int callbacks)
+{
+    impl_->outputQueue(callbacks);
+}
+
+void Manager::latency(LatencyInfo & out) const
+{
+    impl_->latency(out);
+}
+
+void Manager::onFinish(FinishCallback callback, void * userData)
+{
+    impl_->onFinish(callback, userData);
+}
+
 void Manager::start()
 {
     impl_->start();
@@ -335,7 +1099,7 @@ void Manager::start()
 
 void Manager::stop()
 {
-    impl_->stop();
+    impl_->stop(true);
 }
 
 void Manager::poll()
@@ -0,0 +1,147 @@
+#include <limits.h>
+
+#include <algorithm>
+
+#include <s3eMemory.h>
+
+#include <IwDebug.h>
+
+#include <atomics.h>
+
+#include "audio/Memory.h"
+
+namespace audio {
+
+extern AtomicFunctions atomics;
+
+namespace {
+
+// Marks blocks made by allocate, s3e hooks may see blocks of the previous
+// memory manager too.
+const unsigned headerMagic = 0xa0d10a11;
+
+union Header {
+    struct {
+        size_t size;
+        int category;
+        unsigned magic;
+    } info;
+    char align[16];
+};
+
+volatile int inUse[memoryCategories];
+volatile int peak[memoryCategories];
+volatile int allocations[memoryCategories];
+
+// Counters are int, as atomics operate on them, larger blocks are counted
+// at INT_MAX.
+int accounted(size_t size)
+{
+    return static_cast<int>(std::min<size_t>(size, INT_MAX));
+}
+
+void track(int category, int delta)
+{
+    int now = atomics.add(&inUse[category], delta) + delta;
+    for(int old = atomics.cas(&peak[category], 0, 0); old < now;)
+    {
+        int res = atomics.cas(&peak[category], old, now);
+        if(res == old)
+            break;
+        old = res;
+    }
+}
+
+s3eMemoryUsrMgr previous;
+
+bool tracked(void * data)
+{
+    return !data || (static_cast<Header*>(data) - 1)->info.magic == headerMagic;
+}
+
+void * myMalloc(int size)
+{
+    return size >= 0 ? allocate(size, memoryOther) : 0;
+}
+
+void * myRealloc(void * item, int size)
+{
+    if(size < 0)
+        return 0;
+    if(tracked(item))
+        return reallocate(item, size);
+    IwAssertMsg(AUDIO_MEMORY, previous.m_Realloc, ("Block allocated before installMemoryManager"));
+    return previous.m_Realloc ? previous.m_Realloc(item, size) : 0;
+}
+
+void myFree(void * item)
+{
+    if(tracked(item))
+        deallocate(item);
+    else {
+        IwAssertMsg(AUDIO_MEMORY, previous.m_Free, ("Block allocated before installMemoryManager"));
+        if(previous.m_Free)
+            previous.m_Free(item);
+    }
+}
+
+s3eMemoryUsrMgr mm = { myMalloc, myRealloc, myFree };
+
+}
+
+void * allocate(size_t size, MemoryCategory category)
+{
+    Header * header = static_cast<Header*>(atomics.malloc(size + sizeof(Header)));
+    if(!header)
+        return 0;
+    header->info.size = size;
+    header->info.category = category;
+    header->info.magic = headerMagic;
+    track(category, accounted(size));
+    atomics.add(&allocations[category], 1);
+    return header + 1;
+}
+
+void * reallocate(void * data, size_t size)
+{
+    if(!data)
+        return allocate(size, memoryOther);
+
+    Header * header = static_cast<Header*>(data) - 1;
+    size_t oldSize = header->info.size;
+    int category = header->info.category;
+    header = static_cast<Header*>(atomics.realloc(header, size + sizeof(Header)));
+    if(!header)
+        return 0;
+    header->info.size = size;
+    track(category, accounted(size) - accounted(oldSize));
+    return header + 1;
+}
+
+void deallocate(void * data)
+{
+    if(!data)
+        return;
+    Header * header = static_cast<Header*>(data) - 1;
+    track(header->info.category, -accounted(header->info.size));
+    header->info.magic = 0;
+    atomics.add(&allocations[header->info.category], -1);
+    atomics.free(header);
+}
+
+MemoryStats memoryStats(MemoryCategory category)
+{
+    MemoryStats result;
+    result.inUse = atomics.cas(&inUse[category], 0, 0);
+    result.peak = atomics.cas(&peak[category], 0, 0);
+    result.allocations = atomics.cas(&allocations[category], 0, 0);
+    return result;
+}
+
+void installMemoryManager()
+{
+    s3eMemoryGetUserMemMgr(&previous);
+    s3eMemorySetUserMemMgr(&mm);
+}
+
+}
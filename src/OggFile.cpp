@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <vector>
+
 #include <IwDebug.h>
 
 #include <vorbis/vorbisfile.h>
@@ -64,12 +67,121 @@ ov_callbacks ovMemoryCallbacks = {
     ovMemoryTell,
 };
 
+// Parsed headers, codebooks and seek table of one asset. Instances playing
+// the same buffer borrow them read-only and keep only their own decoder state.
+struct SharedSetup {
+    Buffer data;
+    OVMemoryBuffer buffer;
+    OggVorbis_File vf;
+    int users;
+};
+
+volatile int cacheLock = 0;
+std::vector<SharedSetup*> cache;
+
+void lockCache()
+{
+    while(atomics.cas(&cacheLock, 0, 1))
+        atomics.sched_yield();
+}
+
+void unlockCache()
+{
+    atomics.cas(&cacheLock, 1, 0);
+}
+
+SharedSetup * findSetup(const Buffer & buffer)
+{
+    for(std::vector<SharedSetup*>::iterator i = cache.begin(), end = cache.end(); i != end; ++i)
+        if((*i)->data.data() == buffer.data() && (*i)->data.size() == buffer.size())
+            return *i;
+    return 0;
+}
+
+SharedSetup * openSetup(const Buffer & buffer)
+{
+    SharedSetup * result = new SharedSetup;
+    result->data = buffer;
+    result->buffer.begin = result->buffer.pos = buffer.data();
+    result->buffer.end = buffer.data() + buffer.size();
+    result->users = 1;
+    memset(&result->vf, 0, sizeof(result->vf));
+
+    int res = ov_open_callbacks(&result->buffer, &result->vf, 0, 0, ovMemoryCallbacks);
+    if(res < 0 || !result->vf.seekable)
+    {
+        IwAssertMsg(AUDIO_OGGFILE, res >= 0, ("Failed to open ogg stream: %d", res));
+        ov_clear(&result->vf);
+        delete result;
+        return 0;
+    }
+    s3eDebugTracePrintf("rate: %d", static_cast<int>(ov_info(&result->vf, -1)->rate));
+
+    // Decode tables are built lazily into the shared codec setup by the first
+    // synthesis init, do it here for every link so instances only read them.
+    for(int i = 0; i != result->vf.links; ++i)
+    {
+        vorbis_dsp_state dsp;
+        if(vorbis_synthesis_init(&dsp, result->vf.vi + i) == 0)
+            vorbis_dsp_clear(&dsp);
+    }
+    vorbis_block_clear(&result->vf.vb);
+    vorbis_dsp_clear(&result->vf.vd);
+    result->vf.ready_state = OPENED;
+    return result;
+}
+
+SharedSetup * acquireSetup(const Buffer & buffer)
+{
+    lockCache();
+    SharedSetup * result = findSetup(buffer);
+    if(result)
+        ++result->users;
+    unlockCache();
+    if(result)
+        return result;
+
+    SharedSetup * created = openSetup(buffer);
+    if(!created)
+        return 0;
+
+    lockCache();
+    result = findSetup(buffer);
+    if(result)
+        ++result->users;
+    else
+        cache.push_back(result = created);
+    unlockCache();
+
+    if(result != created)
+    {
+        ov_clear(&created->vf);
+        delete created;
+    }
+    return result;
+}
+
+void releaseSetup(SharedSetup * setup)
+{
+    lockCache();
+    bool last = !--setup->users;
+    if(last)
+        cache.erase(std::find(cache.begin(), cache.end(), setup));
+    unlockCache();
+
+    if(last)
+    {
+        ov_clear(&setup->vf);
+        delete setup;
+    }
+}
+
 }
 
 class OggFile::Impl {
 public:
     Impl(const Buffer & buffer)
-        : data_(buffer)
+        : data_(buffer), setup_(0)
     {
         memset(&vf_, 0, sizeof(vf_));
         buffer_.begin = data_.data();
@@ -79,13 +191,70 @@ public:
 
     ~Impl()
     {
+        if(setup_)
+        {
+            vf_.links = 0;
+            vf_.offsets = 0;
+            vf_.dataoffsets = 0;
+            vf_.serialnos = 0;
+            vf_.pcmlengths = 0;
+            vf_.vi = 0;
+            vf_.vc = 0;
+        }
         ov_clear(&vf_);
+        if(setup_)
+            releaseSetup(setup_);
     }
 
+    // Interleaved output of ov_read is averaged in place, like readFloat.
     long read(void * out, size_t len)
     {
         int bitstream = -1;
         long result = ov_read(handle(), static_cast<char*>(out), len, 0, 2, 1, &bitstream);
+        if(result <= 0)
+            return result;
+
+        int channels = ov_info(handle(), bitstream)->channels;
+        if(channels > 1)
+        {
+            int16_t * samples = static_cast<int16_t*>(out);
+            long frames = result / (2 * channels);
+            for(long i = 0; i != frames; ++i)
+            {
+                int sum = 0;
+                for(int c = 0; c != channels; ++c)
+                    sum += samples[i * channels + c];
+                samples[i] = static_cast<int16_t>(sum / channels);
+            }
+            result = frames * 2;
+        }
+        return result;
+    }
+
+    long readFloat(float * out, size_t frames)
+    {
+        if(!frames)
+            return 0;
+        int bitstream = -1;
+        float ** pcm = 0;
+        long result = ov_read_float(handle(), &pcm, static_cast<int>(frames), &bitstream);
+        if(result <= 0)
+            return result;
+
+        int channels = ov_info(handle(), -1)->channels;
+        if(channels == 1)
+            memcpy(out, pcm[0], result * sizeof(float));
+        else
+        {
+            float scale = 1.0f / channels;
+            for(long i = 0; i != result; ++i)
+            {
+                float sum = 0;
+                for(int c = 0; c != channels; ++c)
+                    sum += pcm[c][i];
+                out[i] = sum * scale;
+            }
+        }
         return result;
     }
 
@@ -93,18 +262,44 @@ public:
     {
         if(vf_.datasource == 0)
         {
-            int res = ov_open_callbacks(&buffer_, &vf_, 0, 0, ovMemoryCallbacks);
-            IwAssertMsg(AUDIO_OGGFILE, res >= 0, ("Failed to open ogg stream: %d", res));
-            
-            vorbis_info * info = ov_info(handle(), -1);
-            s3eDebugTracePrintf("rate: %d", static_cast<int>(info->rate));
+            setup_ = acquireSetup(data_);
+            if(setup_)
+                attach();
+            else {
+                int res = ov_open_callbacks(&buffer_, &vf_, 0, 0, ovMemoryCallbacks);
+                IwAssertMsg(AUDIO_OGGFILE, res >= 0, ("Failed to open ogg stream: %d", res));
+            }
         }
         return &vf_;
     }
 private:
+    // Opens stream using shared setup, only sync and decoder state are created.
+    void attach()
+    {
+        const OggVorbis_File & shared = setup_->vf;
+        vf_.datasource = &buffer_;
+        vf_.seekable = shared.seekable;
+        vf_.end = shared.end;
+        vf_.links = shared.links;
+        vf_.offsets = shared.offsets;
+        vf_.dataoffsets = shared.dataoffsets;
+        vf_.serialnos = shared.serialnos;
+        vf_.pcmlengths = shared.pcmlengths;
+        vf_.vi = shared.vi;
+        vf_.vc = shared.vc;
+        vf_.callbacks = ovMemoryCallbacks;
+        ogg_sync_init(&vf_.oy);
+        ogg_stream_init(&vf_.os, -1);
+        vf_.ready_state = OPENED;
+
+        int res = ov_raw_seek(&vf_, 0);
+        IwAssertMsg(AUDIO_OGGFILE, res == 0, ("Failed to attach ogg stream: %d", res));
+    }
+
     Buffer data_;
     OVMemoryBuffer buffer_;
     OggVorbis_File vf_;
+    SharedSetup * setup_;
 };
 
 OggFile::OggFile(const Buffer & buffer)
@@ -117,6 +312,11 @@ long OggFile::read(void * out, size_t len)
     return impl_->read(out, len);
 }
 
+long OggFile::readFloat(float * out, size_t frames)
+{
+    return impl_->readFloat(out, frames);
+}
+
 OggVorbis_File * OggFile::handle()
 {
     return impl_->handle();
@@ -136,4 +336,15 @@ void OggFile::rewind()
     ov_raw_seek(handle(), 0);
 }
 
+bool OggFile::seek(int64_t frame)
+{
+    return ov_pcm_seek(handle(), frame) == 0;
+}
+
+int64_t OggFile::length()
+{
+    ogg_int64_t result = ov_pcm_total(handle(), -1);
+    return result >= 0 ? result : -1;
+}
+
 }
@@ -1,8 +1,10 @@
+#include <s3eDebug.h>
 #include <s3eSound.h>
 
-#include <speex/speex_resampler.h>
-
 #include "audio/File.h"
+#include "audio/Memory.h"
+#include "audio/Resampler.h"
+#include "audio/Trace.h"
 #include "audio/Utils.h"
 
 #include "audio/OnFlyDecoder.h"
@@ -13,15 +15,20 @@ namespace {
 
 const size_t decodeBufferSize = 0x800;
 const size_t bufferSize = 0x8000;
+const size_t prerollSize = decodeBufferSize / 2;
+const size_t rateChunkSize = 0x100;
 
 }
 
 class OnFlyDecoder::Impl {
 public:
-    Impl(File & source)
-        : source_(source), resampler_(0), resamplerRate_(0),
-          decodeBuffer_(new int16_t[decodeBufferSize]), decodeUsed_(0),
-          begin_(new int16_t[bufferSize]), volume_(0x100)
+    Impl(File & source, ResamplerType type)
+        : source_(source), type_(type), resamplerRate_(0),
+          decodeBuffer_(static_cast<int16_t*>(allocate(decodeBufferSize * 2, memoryStreams))), decodeUsed_(0),
+          begin_(static_cast<int16_t*>(allocate(bufferSize * 2, memoryStreams))), flush_(0), volume_(0x100), rate_(normalRate), phase_(0),
+          played_(0),
+          position_(0), loopBegin_(0), loopEnd_(-1), resume_(-1), prerollPending_(0), seek_(-1),
+          preroll_(static_cast<int16_t*>(allocate(prerollSize * 2, memoryStreams))), prerollUsed_(0), prerollReady_(false)
     {
         memset(decodeBuffer_, 0, decodeBufferSize * 2);
         end_ = begin_ + bufferSize;
@@ -30,10 +37,9 @@ public:
 
     ~Impl()
     {
-        delete [] begin_;
-        delete [] decodeBuffer_;
-        if(resampler_)
-            speex_resampler_destroy(resampler_);
+        deallocate(preroll_);
+        deallocate(begin_);
+        deallocate(decodeBuffer_);
     }
 
     File & source()
@@ -48,15 +54,17 @@ public:
 
         if(resamplerRate_ != rate)
         {
-            if(resampler_)
-                speex_resampler_destroy(resampler_);
-            int err = 0;
-            resampler_ = speex_resampler_init(1, rate, outputRate, 0, &err);
+            resampler_.reset(audio::createResampler(type_, rate, outputRate));
+            resamplerRate_ = rate;
         }
     }
 
     bool poll()
     {
+        AUDIO_TRACE_SCOPE("OnFlyDecoder::poll");
+        if(seek_ >= 0)
+            processSeek();
+
         int16_t * writer = reinterpret_cast<int16_t*>(writer_);
         int16_t * reader = reinterpret_cast<int16_t*>(atomics.cas(&reader_, 0, 0));
         if(reader == begin_)
@@ -67,18 +75,22 @@ public:
         decode();
 
         if(reader == writer)
+        {
+            source_.poll();
             return false;
+        }
         int avail = reader > writer ? reader - writer : (end_ - writer) + (reader - begin_);
-        if(resampler_ == 0)
+        if(!resampler_.get())
             createResampler();
 
+        AUDIO_TRACE_SCOPE("OnFlyDecoder::resample");
         int16_t * start = decodeBuffer_;
         int16_t * stop = start + decodeUsed_;
         if(reader > writer)
         {
             uint32_t inlen = stop - start;
             uint32_t outlen = reader - writer;
-            speex_resampler_process_int(resampler_, 0, start, &inlen, writer, &outlen);
+            resampler_->process(start, inlen, writer, outlen);
 
             start += inlen;
             writer += outlen;
@@ -86,7 +98,7 @@ public:
         {
             uint32_t inlen = stop - start;
             uint32_t outlen = end_ - writer;
-            speex_resampler_process_int(resampler_, 0, start, &inlen, writer, &outlen);
+            resampler_->process(start, inlen, writer, outlen);
 
             start += inlen;
             writer += outlen;
@@ -96,7 +108,7 @@ public:
             {
                 inlen = stop - start;
                 outlen = reader - writer;
-                speex_resampler_process_int(resampler_, 0, start, &inlen, writer, &outlen);
+                resampler_->process(start, inlen, writer, outlen);
 
                 start += inlen;
                 writer += outlen;
@@ -107,6 +119,7 @@ public:
         {
             decodeUsed_ = stop - start;
             memmove(decodeBuffer_, start, decodeUsed_ * 2);
+            prerollPending_ -= std::min<size_t>(prerollPending_, start - decodeBuffer_);
         }
 
         atomics.add(&writer_, reinterpret_cast<int>(writer) - writer_);
@@ -119,22 +132,51 @@ public:
         volume_ = value;
     }
 
+    void playbackRate(int value)
+    {
+        rate_ = clampRate(value);
+    }
+
+    void loop(int64_t begin, int64_t end)
+    {
+        // Queued preroll of the old region is continued from.
+        if(resume_ >= 0)
+            position_ = resume_;
+        resume_ = -1;
+        prerollPending_ = 0;
+        loopBegin_ = begin;
+        loopEnd_ = end;
+        preparePreroll();
+    }
+
+    void seek(int64_t frame)
+    {
+        resume_ = -1;
+        prerollPending_ = 0;
+        seek_ = frame;
+    }
+
+    int position() const
+    {
+        return played_;
+    }
+
     int mix(int16_t * out, int limit)
     {
-        int16_t * reader = reinterpret_cast<int16_t*>(reader_);
-        int16_t * writer = reinterpret_cast<int16_t*>(atomics.cas(&writer_, 0, 0));
-        if(writer == reader)
+        int16_t * reader;
+        size_t ready = readable(reader);
+        if(!ready)
             return 0;
-        size_t ready = reader < writer ? writer - reader : (end_ - reader) + (writer - begin_);
+        int rate = rate_;
+        if(rate != normalRate || phase_)
+            return mixResampled(out, limit, reader, ready, rate);
+
         size_t result = std::min<size_t>(ready, limit);
-        if(reader < writer)
-            audio::mix(true, out, reader, volume_, result);
-        else {
-            size_t tailSize = std::min<size_t>(end_ - reader, result);
-            audio::mix(true, out, reader, volume_, tailSize);
-            if(result > tailSize)
-                audio::mix(true, out + tailSize, begin_, volume_, result - tailSize);
-        }
+        size_t tailSize = std::min<size_t>(end_ - reader, result);
+        audio::mix(true, out, reader, volume_, tailSize);
+        if(result > tailSize)
+            audio::mix(true, out + tailSize, begin_, volume_, result - tailSize);
+        played_ += result;
         reader += result;
         if(reader >= end_)
             reader = begin_ + (reader - end_);
@@ -142,21 +184,205 @@ public:
         
         return result;
     }
+
+    // Drops queued samples a mix of limit frames would consume, the decoder
+    // keeps filling the ring, so the stream stays in time while culled.
+    int skip(int limit)
+    {
+        int16_t * reader;
+        size_t ready = readable(reader);
+        if(!ready)
+            return 0;
+        uint64_t advance = static_cast<uint64_t>(limit) * static_cast<uint32_t>(rate_) + phase_;
+        size_t frames = static_cast<size_t>(std::min<uint64_t>(advance >> 16, ready));
+        phase_ = static_cast<uint32_t>(advance & 0xffff);
+        reader += frames;
+        if(reader >= end_)
+            reader = begin_ + (reader - end_);
+        atomics.add(&reader_, reinterpret_cast<int>(reader) - reader_);
+        played_ += limit;
+        return limit;
+    }
 private:
+    // Applies a pending flush and returns number of queued samples.
+    size_t readable(int16_t *& reader)
+    {
+        // Writer is loaded first, samples after a seek are written only once
+        // its flush point is published, so a writer seen without a flush
+        // never includes them. After a flush writer is loaded again.
+        int writerPos = atomics.cas(&writer_, 0, 0);
+        int flush = atomics.cas(&flush_, 0, 0);
+        if(flush)
+        {
+            atomics.add(&reader_, flush - reader_);
+            atomics.cas(&flush_, flush, 0);
+            writerPos = atomics.cas(&writer_, 0, 0);
+        }
+
+        reader = reinterpret_cast<int16_t*>(reader_);
+        int16_t * writer = reinterpret_cast<int16_t*>(writerPos);
+        return reader <= writer ? writer - reader : (end_ - reader) + (writer - begin_);
+    }
+
+    // Ring is copied to a small linear chunk, so interpolation never crosses the wrap.
+    int mixResampled(int16_t * out, int limit, int16_t * reader, size_t ready, uint32_t rate)
+    {
+        int16_t chunk[rateChunkSize];
+        size_t result = 0;
+        while(result < static_cast<size_t>(limit) && ready > 1)
+        {
+            size_t count = std::min(ready, rateChunkSize);
+            size_t tailSize = std::min<size_t>(end_ - reader, count);
+            memcpy(chunk, reader, tailSize * 2);
+            memcpy(chunk + tailSize, begin_, (count - tailSize) * 2);
+
+            size_t consumed = 0;
+            size_t produced = audio::mixResampled(out + result, chunk, count, phase_, rate, volume_, limit - result, consumed);
+            result += produced;
+            ready -= consumed;
+            reader += consumed;
+            if(reader >= end_)
+                reader = begin_ + (reader - end_);
+            if(!produced)
+                break;
+        }
+        atomics.add(&reader_, reinterpret_cast<int>(reader) - reader_);
+        played_ += result;
+
+        return result;
+    }
+
     void decode()
     {
+        AUDIO_TRACE_SCOPE("OnFlyDecoder::decode");
+        if(!prerollReady_)
+            preparePreroll();
+
+        bool wrapped = false;
         while(decodeUsed_ <= decodeBufferSize / 2)
         {
-            long res = source_.read(decodeBuffer_ + decodeUsed_, (decodeBufferSize - decodeUsed_) * 2);
-            if(res == 0)
-                source_.rewind();
-            else
+            if(resume_ >= 0)
+            {
+                if(prerollPending_)
+                    break;
+                if(!resumeSource())
+                    break;
+            }
+
+            int64_t request = decodeBufferSize - decodeUsed_;
+            if(loopEnd_ >= 0)
+                request = std::min<int64_t>(request, loopEnd_ - position_);
+            long res = request > 0 ? source_.read(decodeBuffer_ + decodeUsed_, request * 2) : 0;
+            if(res <= 0)
+            {
+                if(wrapped || !wrap())
+                    break;
+                wrapped = true;
+            } else {
+                wrapped = false;
                 decodeUsed_ += res / 2;
+                position_ += res / 2;
+            }
+        }
+    }
+
+    // Positions the source past the queued preroll. Files that cannot seek
+    // there are rewound to the loop start and read through the preroll, if
+    // even that fails the preroll is dropped and looping ends.
+    bool resumeSource()
+    {
+        int64_t frame = resume_;
+        resume_ = -1;
+        if(source_.seek(frame))
+        {
+            position_ = frame;
+            return true;
+        }
+
+        position_ = loopBegin_;
+        if(source_.seek(loopBegin_))
+        {
+            // Space past decodeUsed_ holds at least prerollSize samples.
+            while(position_ < frame)
+            {
+                long res = source_.read(decodeBuffer_ + decodeUsed_, static_cast<size_t>(frame - position_) * 2);
+                if(res <= 0)
+                    break;
+                position_ += res / 2;
+            }
+            if(position_ == frame)
+                return true;
+        }
+        s3eDebugTracePrintf("audio::OnFlyDecoder, cannot resume loop at %d, preroll dropped", static_cast<int>(frame));
+        prerollUsed_ = 0;
+        return false;
+    }
+
+    // Appends pre-decoded loop start, the source is repositioned past it by a
+    // later poll, once the preroll is resampled into the ring.
+    bool wrap()
+    {
+        if(!prerollUsed_)
+        {
+            if(!source_.seek(loopBegin_))
+                return false;
+            position_ = loopBegin_;
+            return true;
+        }
+
+        memcpy(decodeBuffer_ + decodeUsed_, preroll_, prerollUsed_ * 2);
+        decodeUsed_ += prerollUsed_;
+        prerollPending_ = decodeUsed_;
+        resume_ = loopBegin_ + prerollUsed_;
+        return true;
+    }
+
+    void preparePreroll()
+    {
+        prerollReady_ = true;
+        prerollUsed_ = 0;
+        if(!source_.seek(loopBegin_))
+            return;
+
+        size_t limit = prerollSize;
+        if(loopEnd_ >= 0)
+            limit = static_cast<size_t>(std::max<int64_t>(0, std::min<int64_t>(limit, loopEnd_ - loopBegin_)));
+        while(prerollUsed_ < limit)
+        {
+            long res = source_.read(preroll_ + prerollUsed_, (limit - prerollUsed_) * 2);
+            if(res <= 0)
+                break;
+            prerollUsed_ += res / 2;
+        }
+
+        if(!source_.seek(position_))
+        {
+            // Playback continues from the loop start, the only known position.
+            prerollUsed_ = 0;
+            source_.seek(loopBegin_);
+            position_ = loopBegin_;
         }
     }
 
+    // Drops everything decoded so far, audio thread skips queued samples on next mix.
+    void processSeek()
+    {
+        int64_t frame = seek_;
+        seek_ = -1;
+
+        source_.seek(frame);
+        position_ = frame;
+        resume_ = -1;
+        prerollPending_ = 0;
+        decodeUsed_ = 0;
+        if(resampler_.get())
+            resampler_->reset();
+        atomicsWrite(&flush_, writer_);
+    }
+
     File & source_;
-    SpeexResamplerState * resampler_;
+    ResamplerType type_;
+    std::auto_ptr<Resampler> resampler_;
     int resamplerRate_;
 
     int16_t * decodeBuffer_;
@@ -165,11 +391,26 @@ private:
     int16_t * end_;
     volatile int reader_;
     volatile int writer_;
+    volatile int flush_;
     int volume_;
+    volatile int rate_;
+    uint32_t phase_;
+    int played_;
+
+    int64_t position_;
+    int64_t loopBegin_;
+    int64_t loopEnd_;
+    int64_t resume_;
+    // Decoded samples up to the end of the preroll not yet in the ring.
+    size_t prerollPending_;
+    int64_t seek_;
+    int16_t * preroll_;
+    size_t prerollUsed_;
+    bool prerollReady_;
 };
 
-OnFlyDecoder::OnFlyDecoder(bool owned, File & file)
-    : Source(owned), impl_(new Impl(file))
+OnFlyDecoder::OnFlyDecoder(bool owned, File & file, ResamplerType resampler)
+    : Source(owned), impl_(new Impl(file, resampler))
 {
 }
 
@@ -187,14 +428,39 @@ bool OnFlyDecoder::poll()
     return impl_->poll();
 }
 
+int OnFlyDecoder::skip(int limit)
+{
+    return impl_->skip(limit);
+}
+
 void OnFlyDecoder::volume(int value)
 {
     impl_->volume(value);
 }
 
+void OnFlyDecoder::playbackRate(int value)
+{
+    impl_->playbackRate(value);
+}
+
+void OnFlyDecoder::loop(int64_t begin, int64_t end)
+{
+    impl_->loop(begin, end);
+}
+
+void OnFlyDecoder::seek(int64_t frame)
+{
+    impl_->seek(frame);
+}
+
 int OnFlyDecoder::mix(int16_t * out, int limit)
 {
     return impl_->mix(out, limit);
 }
 
+int OnFlyDecoder::position() const
+{
+    return impl_->position();
+}
+
 }
@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <vector>
+
+#include <IwDebug.h>
+
+#include "audio/Playlist.h"
+
+namespace audio {
+
+namespace {
+
+// How early, in frames, next track is opened and its beginning decoded.
+const int64_t prefetchDistance = 0x10000;
+const size_t prefetchFrames = 0x1000;
+const int fadeOne = 0x8000;
+
+struct Track {
+    File * file;
+    bool owned;
+};
+
+struct Head {
+    std::vector<int16_t> samples;
+    size_t pos;
+
+    Head()
+        : pos(0)
+    {
+    }
+
+    void clear()
+    {
+        samples.clear();
+        pos = 0;
+    }
+};
+
+// Reads samples already decoded to head first, then continues from the file.
+size_t readTrack(File & file, Head & head, int16_t * out, size_t len)
+{
+    size_t result = std::min(len, head.samples.size() - head.pos);
+    if(result)
+    {
+        memcpy(out, &head.samples[head.pos], result * 2);
+        head.pos += result;
+    }
+    while(result < len)
+    {
+        long res = file.read(out + result, (len - result) * 2);
+        if(res <= 0)
+            break;
+        result += res / 2;
+    }
+    return result;
+}
+
+}
+
+class Playlist::Impl {
+public:
+    Impl()
+        : crossfade_(0), loop_(false), current_(0), position_(0),
+          next_(0), nextPosition_(0), nextReady_(false)
+    {
+    }
+
+    ~Impl()
+    {
+        for(std::vector<Track>::iterator i = tracks_.begin(), end = tracks_.end(); i != end; ++i)
+            if(i->owned)
+                delete i->file;
+    }
+
+    void add(File * file, bool owned)
+    {
+        Track track = { file, owned };
+        tracks_.push_back(track);
+    }
+
+    void crossfade(int frames)
+    {
+        crossfade_ = std::max(frames, 0);
+    }
+
+    void loop(bool value)
+    {
+        loop_ = value;
+    }
+
+    long read(void * out, size_t len)
+    {
+        int16_t * output = static_cast<int16_t*>(out);
+        size_t samples = len / 2;
+        size_t produced = 0;
+        while(produced < samples && current_ < tracks_.size())
+        {
+            int64_t remaining = this->remaining();
+            // Fallback when poll was not called in time, crossfade needs the
+            // next track before this read reaches it.
+            if(!nextReady_ && crossfade_ && remaining >= 0 &&
+               remaining <= crossfade_ + static_cast<int64_t>(samples - produced))
+                prepareNext();
+
+            bool fadeable = nextReady_ && next_ != current_ && crossfade_ && remaining >= 0;
+            bool fading = fadeable && remaining <= crossfade_;
+            size_t request = samples - produced;
+            if(fading)
+                request = static_cast<size_t>(std::min<int64_t>(request, remaining));
+            else if(fadeable)
+                request = static_cast<size_t>(std::min<int64_t>(request, remaining - crossfade_));
+
+            size_t got = request ? readTrack(*tracks_[current_].file, head_, output + produced, request) : 0;
+            if(fading)
+                blend(output + produced, got, remaining);
+            position_ += got;
+            produced += got;
+
+            if(!got || (fading && static_cast<int64_t>(got) == remaining))
+                if(!advance())
+                    break;
+        }
+        return produced * 2;
+    }
+
+    void poll()
+    {
+        if(nextReady_ || current_ >= tracks_.size())
+            return;
+        int64_t remaining = this->remaining();
+        if(remaining >= 0 && remaining <= prefetchDistance)
+            prepareNext();
+    }
+
+    int rate()
+    {
+        IwAssertMsg(AUDIO_PLAYLIST, !tracks_.empty(), ("Rate of empty playlist"));
+        return tracks_[std::min(current_, tracks_.size() - 1)].file->rate();
+    }
+
+    void rewind()
+    {
+        current_ = 0;
+        position_ = 0;
+        head_.clear();
+        nextReady_ = false;
+        nextHead_.clear();
+        if(!tracks_.empty())
+            tracks_[0].file->rewind();
+    }
+
+    bool seek(int64_t frame)
+    {
+        if(frame < 0)
+            return false;
+        int64_t start = 0;
+        for(size_t i = 0; i != tracks_.size(); ++i)
+        {
+            bool last = i + 1 == tracks_.size();
+            int64_t len = tracks_[i].file->length();
+            // Crossfade region belongs to the track fading out.
+            int64_t end = len < 0 ? -1 : start + len - (last ? 0 : crossfade_);
+            if(end < 0 || frame < end || (last && frame == end))
+            {
+                if(!tracks_[i].file->seek(frame - start))
+                    return false;
+                current_ = i;
+                position_ = frame - start;
+                head_.clear();
+                nextReady_ = false;
+                nextHead_.clear();
+                return true;
+            }
+            start = end;
+        }
+        return false;
+    }
+
+    int64_t length()
+    {
+        if(loop_)
+            return -1;
+        int64_t result = 0;
+        for(std::vector<Track>::iterator i = tracks_.begin(), end = tracks_.end(); i != end; ++i)
+        {
+            int64_t len = i->file->length();
+            if(len < 0)
+                return -1;
+            result += len;
+        }
+        if(tracks_.size() > 1)
+            result -= static_cast<int64_t>(crossfade_) * (tracks_.size() - 1);
+        return result;
+    }
+private:
+    // Frames left in the current track, -1 if its length is unknown.
+    int64_t remaining()
+    {
+        int64_t result = tracks_[current_].file->length();
+        return result >= 0 ? std::max<int64_t>(result - position_, 0) : -1;
+    }
+
+    // Opens next track and decodes its beginning, called well before the
+    // current track ends.
+    void prepareNext()
+    {
+        size_t next = current_ + 1;
+        if(next == tracks_.size())
+        {
+            if(!loop_)
+                return;
+            next = 0;
+        }
+        if(next == current_)
+        {
+            // The track itself is still being read, it is rewound on advance.
+            next_ = next;
+            nextPosition_ = 0;
+            nextHead_.clear();
+            nextReady_ = true;
+            return;
+        }
+
+        File & file = *tracks_[next].file;
+        file.rewind();
+        IwAssertMsg(AUDIO_PLAYLIST, file.rate() == tracks_[current_].file->rate(),
+                    ("Playlist tracks have different rates: %d, %d", file.rate(), tracks_[current_].file->rate()));
+
+        nextHead_.clear();
+        nextHead_.samples.resize(prefetchFrames);
+        Head empty;
+        nextHead_.samples.resize(readTrack(file, empty, &nextHead_.samples[0], prefetchFrames));
+
+        next_ = next;
+        nextPosition_ = 0;
+        nextReady_ = true;
+    }
+
+    // Fades current track out and the next one in, remaining is number of
+    // frames left in the current track before out.
+    void blend(int16_t * out, size_t len, int64_t remaining)
+    {
+        fadeBuffer_.resize(len);
+        size_t got = readTrack(*tracks_[next_].file, nextHead_, &fadeBuffer_[0], len);
+        std::fill(fadeBuffer_.begin() + got, fadeBuffer_.end(), 0);
+        nextPosition_ += got;
+
+        int64_t start = crossfade_ - remaining;
+        for(size_t i = 0; i != len; ++i)
+        {
+            int gain = static_cast<int>((start + i) * fadeOne / crossfade_);
+            out[i] = (out[i] * (fadeOne - gain) + fadeBuffer_[i] * gain) / fadeOne;
+        }
+    }
+
+    bool advance()
+    {
+        if(!nextReady_)
+            prepareNext();
+        if(!nextReady_)
+            return false;
+        if(next_ == current_)
+        {
+            // Stops instead of spinning on a track that has no samples.
+            if(!position_)
+                return false;
+            tracks_[current_].file->rewind();
+        }
+
+        current_ = next_;
+        position_ = nextPosition_;
+        std::swap(head_, nextHead_);
+        nextHead_.clear();
+        nextReady_ = false;
+        return true;
+    }
+
+    std::vector<Track> tracks_;
+    int crossfade_;
+    bool loop_;
+
+    size_t current_;
+    int64_t position_;
+    Head head_;
+
+    size_t next_;
+    int64_t nextPosition_;
+    Head nextHead_;
+    bool nextReady_;
+
+    std::vector<int16_t> fadeBuffer_;
+};
+
+Playlist::Playlist()
+    : impl_(new Impl)
+{
+}
+
+Playlist::~Playlist()
+{
+}
+
+void Playlist::add(File * file, bool owned)
+{
+    impl_->add(file, owned);
+}
+
+void Playlist::crossfade(int frames)
+{
+    impl_->crossfade(frames);
+}
+
+void Playlist::loop(bool value)
+{
+    impl_->loop(value);
+}
+
+long Playlist::read(void * out, size_t len)
+{
+    return impl_->read(out, len);
+}
+
+void Playlist::poll()
+{
+    impl_->poll();
+}
+
+int Playlist::rate()
+{
+    return impl_->rate();
+}
+
+void Playlist::rewind()
+{
+    impl_->rewind();
+}
+
+bool Playlist::seek(int64_t frame)
+{
+    return impl_->seek(frame);
+}
+
+int64_t Playlist::length()
+{
+    return impl_->length();
+}
+
+}
@@ -0,0 +1,283 @@
+#include <vector>
+
+#include <s3eDebug.h>
+#include <s3eFile.h>
+#include <s3eThread.h>
+#include <s3eTimer.h>
+
+#include <IwDebug.h>
+
+#include "audio/Adpcm.h"
+#include "audio/Decoder.h"
+#include "audio/File.h"
+#include "audio/Utils.h"
+
+#include "audio/Preloader.h"
+
+namespace audio {
+
+namespace {
+
+const size_t maxThreads = 8;
+// Decode time slice, cancellation is checked between slices.
+const int decodeStep = 5000;
+
+enum ItemState {
+    itemPending,
+    itemLoading,
+    itemDone
+};
+
+struct Item {
+    std::string fname;
+    PreloadMode mode;
+    int priority;
+    int volume;
+    ResamplerType resampler;
+    ItemState state;
+    uint64 size;
+    Buffer result;
+};
+
+}
+
+class Preloader::Impl {
+public:
+    Impl()
+        : lock_(0), cancelled_(0), running_(0), threadsSize_(0), assetsDone_(0), bytesDone_(0),
+          bytesKnown_(0), sizesKnown_(0), startTime_(0)
+    {
+    }
+
+    ~Impl()
+    {
+        cancel();
+        join();
+    }
+
+    size_t add(const std::string & fname, PreloadMode mode, int priority, int volume, ResamplerType resampler)
+    {
+        Item item;
+        item.fname = fname;
+        item.mode = mode;
+        item.priority = priority;
+        item.volume = volume;
+        item.resampler = resampler;
+        item.state = itemPending;
+        item.size = 0;
+
+        lock();
+        size_t result = items_.size();
+        items_.push_back(item);
+        unlock();
+        return result;
+    }
+
+    void start(int threads)
+    {
+        IwAssertMsg(AUDIO_PRELOADER, !threadsSize_, ("Preloader already started"));
+        startTime_ = s3eTimerGetUSTNanoseconds();
+        size_t requested = std::max<size_t>(1, std::min<size_t>(threads, maxThreads));
+        atomicsWrite(&running_, requested);
+        for(size_t i = 0; i != requested; ++i)
+        {
+            s3eThread * thread = s3eThreadCreate(&Impl::worker, this, 0);
+            if(thread)
+                threads_[threadsSize_++] = thread;
+            else
+                atomics.add(&running_, -1);
+        }
+        if(!threadsSize_)
+        {
+            s3eDebugTracePrintf("audio::Preloader, cannot create threads, loading on calling thread");
+            atomics.add(&running_, 1);
+            worker(this);
+        }
+    }
+
+    void cancel()
+    {
+        atomicsWrite(&cancelled_, 1);
+    }
+
+    bool done()
+    {
+        lock();
+        bool result = assetsDone_ == items_.size();
+        unlock();
+        return result || (cancelled() && !atomics.cas(&running_, 0, 0));
+    }
+
+    PreloadProgress progress()
+    {
+        PreloadProgress result;
+        lock();
+        result.assetsDone = assetsDone_;
+        result.assetsTotal = items_.size();
+        result.bytesDone = bytesDone_;
+        uint64 bytesKnown = bytesKnown_;
+        size_t sizesKnown = sizesKnown_;
+        unlock();
+
+        result.bytesTotal = bytesKnown;
+        if(sizesKnown)
+            result.bytesTotal += bytesKnown / sizesKnown * (result.assetsTotal - sizesKnown);
+
+        result.timeLeft = -1;
+        uint64 elapsed = s3eTimerGetUSTNanoseconds() - startTime_;
+        if(result.bytesDone && startTime_)
+            result.timeLeft = static_cast<int>(elapsed / 1000000 * (result.bytesTotal - result.bytesDone) / result.bytesDone);
+        return result;
+    }
+
+    Buffer result(size_t index)
+    {
+        lock();
+        Buffer result = items_[index].state == itemDone ? items_[index].result : Buffer();
+        unlock();
+        return result;
+    }
+private:
+    void lock()
+    {
+        while(atomics.cas(&lock_, 0, 1))
+            atomics.sched_yield();
+    }
+
+    void unlock()
+    {
+        atomics.cas(&lock_, 1, 0);
+    }
+
+    bool cancelled()
+    {
+        return atomics.cas(&cancelled_, 0, 0) != 0;
+    }
+
+    void join()
+    {
+        for(size_t i = 0; i != threadsSize_; ++i)
+            s3eThreadJoin(threads_[i], 0);
+        threadsSize_ = 0;
+    }
+
+    static void * worker(void * user)
+    {
+        Impl * impl = static_cast<Impl*>(user);
+        impl->work();
+        atomics.add(&impl->running_, -1);
+        return 0;
+    }
+
+    void work()
+    {
+        for(;;)
+        {
+            if(cancelled())
+                break;
+
+            lock();
+            Item * item = 0;
+            for(std::vector<Item>::iterator i = items_.begin(), end = items_.end(); i != end; ++i)
+                if(i->state == itemPending && (!item || i->priority > item->priority))
+                    item = &*i;
+            if(item)
+                item->state = itemLoading;
+            std::string fname = item ? item->fname : std::string();
+            PreloadMode mode = item ? item->mode : preloadRaw;
+            int volume = item ? item->volume : 0x100;
+            ResamplerType resampler = item ? item->resampler : resamplerSpeex;
+            size_t index = item ? item - &items_[0] : 0;
+            unlock();
+
+            if(!item)
+                break;
+
+            Buffer data = loadFile(fname);
+            lock();
+            items_[index].size = data.size();
+            bytesKnown_ += data.size();
+            ++sizesKnown_;
+            unlock();
+
+            Buffer result = data;
+            if(mode != preloadRaw && !data.empty())
+                result = decode(data, volume, mode, resampler);
+
+            lock();
+            items_[index].result.swap(result);
+            items_[index].state = itemDone;
+            bytesDone_ += data.size();
+            ++assetsDone_;
+            unlock();
+        }
+    }
+
+    Buffer decode(const Buffer & data, int volume, PreloadMode mode, ResamplerType resampler)
+    {
+        std::auto_ptr<File> file(openFile(data));
+        if(!file.get())
+            return Buffer();
+        DecodeJob job(*file, volume, defaultBufferAllocator(), resampler);
+        while(!job.step(decodeStep))
+            if(cancelled())
+                return Buffer();
+
+        return mode == preloadAdpcm ? encodeAdpcm(job.result()) : job.result();
+    }
+
+    volatile int lock_;
+    volatile int cancelled_;
+    volatile int running_;
+    std::vector<Item> items_;
+
+    s3eThread * threads_[maxThreads];
+    size_t threadsSize_;
+
+    size_t assetsDone_;
+    uint64 bytesDone_;
+    uint64 bytesKnown_;
+    size_t sizesKnown_;
+    uint64 startTime_;
+};
+
+Preloader::Preloader()
+    : impl_(new Impl)
+{
+}
+
+Preloader::~Preloader()
+{
+}
+
+size_t Preloader::add(const std::string & fname, PreloadMode mode, int priority, int volume, ResamplerType resampler)
+{
+    return impl_->add(fname, mode, priority, volume, resampler);
+}
+
+void Preloader::start(int threads)
+{
+    impl_->start(threads);
+}
+
+void Preloader::cancel()
+{
+    impl_->cancel();
+}
+
+bool Preloader::done() const
+{
+    return impl_->done();
+}
+
+PreloadProgress Preloader::progress() const
+{
+    return impl_->progress();
+}
+
+Buffer Preloader::result(size_t index) const
+{
+    return impl_->result(index);
+}
+
+}
@@ -0,0 +1,307 @@
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <speex/speex_resampler.h>
+
+#include "audio/Resampler.h"
+
+namespace audio {
+
+namespace {
+
+const int fracBits = 16;
+const int fracOne = 1 << fracBits;
+// Samples converted at once by the int16 fallback of processFloat.
+const uint32_t convertChunk = 0x100;
+
+inline int clamp16(int v)
+{
+    return v < -0x8000 ? -0x8000 : (v > 0x7fff ? 0x7fff : v);
+}
+
+inline uint32_t phaseStep(int inputRate, int outputRate)
+{
+    return static_cast<uint32_t>((static_cast<int64_t>(inputRate) << fracBits) / outputRate);
+}
+
+class SpeexResampler : public Resampler {
+public:
+    SpeexResampler(int inputRate, int outputRate)
+        : Resampler(inputRate, outputRate)
+    {
+        int err = 0;
+        state_ = speex_resampler_init(1, inputRate, outputRate, 0, &err);
+    }
+
+    ~SpeexResampler()
+    {
+        speex_resampler_destroy(state_);
+    }
+
+    void process(const int16_t * in, uint32_t & inlen, int16_t * out, uint32_t & outlen)
+    {
+        speex_resampler_process_int(state_, 0, in, &inlen, out, &outlen);
+    }
+
+    void processFloat(const float * in, uint32_t & inlen, float * out, uint32_t & outlen)
+    {
+        speex_resampler_process_float(state_, 0, in, &inlen, out, &outlen);
+    }
+
+    void rates(int inputRate, int outputRate)
+    {
+        inputRate_ = inputRate;
+        outputRate_ = outputRate;
+        speex_resampler_set_rate(state_, inputRate, outputRate);
+    }
+
+    void reset()
+    {
+        speex_resampler_reset_mem(state_);
+    }
+private:
+    SpeexResamplerState * state_;
+};
+
+// Interpolating resamplers keep last input samples as history. Sample index k
+// in the loops below refers to history for k < history and to in[k - history]
+// after that, the main loop only runs over in and has no branches.
+template<int history>
+class InterpolatingResampler : public Resampler {
+public:
+    InterpolatingResampler(int inputRate, int outputRate)
+        : Resampler(inputRate, outputRate), step_(phaseStep(inputRate, outputRate))
+    {
+        reset();
+    }
+
+    void rates(int inputRate, int outputRate)
+    {
+        inputRate_ = inputRate;
+        outputRate_ = outputRate;
+        step_ = phaseStep(inputRate, outputRate);
+    }
+
+    void reset()
+    {
+        memset(history_, 0, sizeof(history_));
+        phase_ = 0;
+    }
+protected:
+    // Drops input samples passed by phase and stores the rest of state.
+    void finish(const int16_t * in, uint32_t & inlen, uint32_t produced, uint32_t & outlen, uint64_t phase)
+    {
+        uint32_t consumed = std::min<uint64_t>(phase >> fracBits, inlen);
+        phase -= static_cast<uint64_t>(consumed) << fracBits;
+
+        // New history is the last samples of history followed by consumed input.
+        int16_t joined[history * 2];
+        uint32_t tail = std::min<uint32_t>(consumed, history);
+        memcpy(joined, history_, sizeof(history_));
+        memcpy(joined + history, in + consumed - tail, tail * sizeof(int16_t));
+        memcpy(history_, joined + tail, sizeof(history_));
+
+        phase_ = phase;
+        inlen = consumed;
+        outlen = produced;
+    }
+
+    int16_t history_[history];
+    uint64_t phase_;
+    uint32_t step_;
+};
+
+class LinearResampler : public InterpolatingResampler<1> {
+public:
+    LinearResampler(int inputRate, int outputRate)
+        : InterpolatingResampler<1>(inputRate, outputRate)
+    {
+    }
+
+    void process(const int16_t * in, uint32_t & inlen, int16_t * out, uint32_t & outlen)
+    {
+        uint64_t phase = phase_;
+        uint32_t step = step_;
+        uint32_t produced = 0;
+        uint64_t limit = static_cast<uint64_t>(inlen) << fracBits;
+
+        // x(0) is history, x(1) is in[0].
+        while(produced != outlen && phase < limit && (phase >> fracBits) == 0)
+        {
+            int frac = phase & (fracOne - 1);
+            int a = history_[0];
+            int b = in[0];
+            out[produced++] = a + static_cast<int>((static_cast<int64_t>(b - a) * frac) >> fracBits);
+            phase += step;
+        }
+
+        // x(k) = in[k - 1]
+        const int16_t * base = in - 1;
+        while(produced != outlen && phase < limit)
+        {
+            uint32_t idx = phase >> fracBits;
+            int frac = phase & (fracOne - 1);
+            int a = base[idx];
+            int b = base[idx + 1];
+            out[produced++] = a + static_cast<int>((static_cast<int64_t>(b - a) * frac) >> fracBits);
+            phase += step;
+        }
+
+        finish(in, inlen, produced, outlen, phase);
+    }
+};
+
+class CubicResampler : public InterpolatingResampler<3> {
+public:
+    CubicResampler(int inputRate, int outputRate)
+        : InterpolatingResampler<3>(inputRate, outputRate)
+    {
+    }
+
+    void process(const int16_t * in, uint32_t & inlen, int16_t * out, uint32_t & outlen)
+    {
+        uint64_t phase = phase_;
+        uint32_t step = step_;
+        uint32_t produced = 0;
+        // Output between x(k) and x(k + 1), k = phase + 1, needs x(k - 1) .. x(k + 2),
+        // x(0) .. x(2) is history.
+        uint64_t limit = static_cast<uint64_t>(inlen) << fracBits;
+
+        while(produced != outlen && phase < limit && (phase >> fracBits) < 3)
+        {
+            uint32_t idx = (phase >> fracBits) + 1;
+            out[produced++] = interpolate(at(in, idx - 1), at(in, idx), at(in, idx + 1), at(in, idx + 2), phase & (fracOne - 1));
+            phase += step;
+        }
+
+        const int16_t * base = in - 3;
+        while(produced != outlen && phase < limit)
+        {
+            uint32_t idx = (phase >> fracBits) + 1;
+            out[produced++] = interpolate(base[idx - 1], base[idx], base[idx + 1], base[idx + 2], phase & (fracOne - 1));
+            phase += step;
+        }
+
+        finish(in, inlen, produced, outlen, phase);
+    }
+private:
+    inline int at(const int16_t * in, uint32_t idx) const
+    {
+        return idx < 3 ? history_[idx] : in[idx - 3];
+    }
+
+    // Catmull-Rom spline between b and c, frac is 16 bit fixed point.
+    static inline int16_t interpolate(int a, int b, int c, int d, int frac)
+    {
+        int f = frac >> 1;
+        int c0 = b;
+        int c1 = (c - a) >> 1;
+        int c2 = a - ((5 * b) >> 1) + 2 * c - (d >> 1);
+        int c3 = ((d - a) >> 1) + ((3 * (b - c)) >> 1);
+        int64_t r = ((static_cast<int64_t>(c3) * f >> 15) + c2) * f >> 15;
+        r = (r + c1) * f >> 15;
+        return clamp16(static_cast<int>(r + c0));
+    }
+};
+
+}
+
+void Resampler::processFloat(const float * in, uint32_t & inlen, float * out, uint32_t & outlen)
+{
+    int16_t input[convertChunk];
+    int16_t output[convertChunk];
+    uint32_t consumed = 0;
+    uint32_t produced = 0;
+    while(consumed != inlen && produced != outlen)
+    {
+        uint32_t chunkIn = std::min(inlen - consumed, convertChunk);
+        uint32_t chunkOut = std::min(outlen - produced, convertChunk);
+        for(uint32_t i = 0; i != chunkIn; ++i)
+            input[i] = static_cast<int16_t>(clamp16(static_cast<int>(floor(in[consumed + i] * 0x8000 + 0.5f))));
+        process(input, chunkIn, output, chunkOut);
+        for(uint32_t i = 0; i != chunkOut; ++i)
+            out[produced + i] = output[i] * (1.0f / 0x8000);
+        consumed += chunkIn;
+        produced += chunkOut;
+        if(!chunkIn && !chunkOut)
+            break;
+    }
+    inlen = consumed;
+    outlen = produced;
+}
+
+namespace {
+
+// Copies samples while rates are equal, switches to a real resampler of the
+// requested type once they differ.
+class CopyResampler : public Resampler {
+public:
+    CopyResampler(ResamplerType type, int rate)
+        : Resampler(rate, rate), type_(type)
+    {
+    }
+
+    void process(const int16_t * in, uint32_t & inlen, int16_t * out, uint32_t & outlen)
+    {
+        if(resampler_.get())
+        {
+            resampler_->process(in, inlen, out, outlen);
+            return;
+        }
+        inlen = outlen = std::min(inlen, outlen);
+        memcpy(out, in, inlen * 2);
+    }
+
+    void processFloat(const float * in, uint32_t & inlen, float * out, uint32_t & outlen)
+    {
+        if(resampler_.get())
+        {
+            resampler_->processFloat(in, inlen, out, outlen);
+            return;
+        }
+        inlen = outlen = std::min(inlen, outlen);
+        memcpy(out, in, inlen * sizeof(float));
+    }
+
+    void rates(int inputRate, int outputRate)
+    {
+        inputRate_ = inputRate;
+        outputRate_ = outputRate;
+        if(resampler_.get())
+            resampler_->rates(inputRate, outputRate);
+        else if(inputRate != outputRate)
+            resampler_.reset(createResampler(type_, inputRate, outputRate));
+    }
+
+    void reset()
+    {
+        if(resampler_.get())
+            resampler_->reset();
+    }
+private:
+    ResamplerType type_;
+    std::auto_ptr<Resampler> resampler_;
+};
+
+}
+
+Resampler * createResampler(ResamplerType type, int inputRate, int outputRate)
+{
+    if(inputRate == outputRate)
+        return new CopyResampler(type, inputRate);
+
+    switch(type) {
+    case resamplerLinear:
+        return new LinearResampler(inputRate, outputRate);
+    case resamplerCubic:
+        return new CubicResampler(inputRate, outputRate);
+    case resamplerSpeex:
+    default:
+        return new SpeexResampler(inputRate, outputRate);
+    }
+}
+
+}
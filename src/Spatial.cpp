@@ -0,0 +1,69 @@
+#include <math.h>
+
+#include <algorithm>
+
+#include "audio/Spatial.h"
+
+namespace audio {
+
+namespace {
+
+float attenuation(const Emitter & emitter, float distance)
+{
+    if(distance >= emitter.maxDistance)
+        return 0;
+    if(distance <= emitter.minDistance)
+        return 1;
+    switch(emitter.curve)
+    {
+    case attenuationLinear:
+        return (emitter.maxDistance - distance) / (emitter.maxDistance - emitter.minDistance);
+    case attenuationInverse:
+        return emitter.minDistance / distance;
+    case attenuationInverseSquare:
+    {
+        float ratio = emitter.minDistance / distance;
+        return ratio * ratio;
+    }
+    }
+    return 0;
+}
+
+inline int toGain(float value)
+{
+    return static_cast<int>(value * 0x100 + 0.5f);
+}
+
+}
+
+void spatialize(const Listener & listener, const Emitter * emitters, size_t count, bool stereo,
+                int * left, int * right)
+{
+    const Vector3 & origin = listener.position;
+    for(size_t i = 0; i != count; ++i)
+    {
+        const Emitter & emitter = emitters[i];
+        float dx = emitter.position.x - origin.x;
+        float dy = emitter.position.y - origin.y;
+        float dz = emitter.position.z - origin.z;
+        float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+        float gain = attenuation(emitter, distance);
+
+        if(!stereo || gain == 0)
+        {
+            left[i] = right[i] = toGain(gain);
+            continue;
+        }
+
+        float side = 0;
+        if(distance > 0)
+        {
+            side = (dx * listener.right.x + dy * listener.right.y + dz * listener.right.z) / distance;
+            side = std::max(-1.0f, std::min(side, 1.0f));
+        }
+        left[i] = toGain(gain * sqrtf((1 - side) * 0.5f));
+        right[i] = toGain(gain * sqrtf((1 + side) * 0.5f));
+    }
+}
+
+}
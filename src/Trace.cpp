@@ -0,0 +1,137 @@
+#include "audio/Trace.h"
+
+#ifdef AUDIO_TRACE
+
+#include <stdio.h>
+
+#include <s3eFile.h>
+#include <s3eThread.h>
+#include <s3eTimer.h>
+
+#include <atomics.h>
+
+#include <algorithm>
+
+namespace audio {
+
+extern AtomicFunctions atomics;
+
+namespace {
+
+const int maxThreads = 8;
+// Ring of the sound callback, callbacks do not run concurrently.
+const int callbackRing = 0;
+// Power of two, oldest events are overwritten.
+const unsigned ringSize = 0x800;
+
+struct Event {
+    const char * name;
+    uint64 begin;
+    uint64 end;
+};
+
+// Written only by its owner thread.
+struct Ring {
+    volatile int claimed;
+    s3eThread * volatile owner;
+    volatile int written;
+    Event events[ringSize];
+};
+
+Ring rings[maxThreads];
+
+Ring * currentRing(bool callback)
+{
+    if(callback)
+    {
+        atomics.cas(&rings[callbackRing].claimed, 0, 1);
+        return &rings[callbackRing];
+    }
+    s3eThread * self = s3eThreadGetCurrent();
+    for(int i = callbackRing + 1; i != maxThreads; ++i)
+        if(rings[i].claimed && rings[i].owner == self)
+            return &rings[i];
+    for(int i = callbackRing + 1; i != maxThreads; ++i)
+        if(!atomics.cas(&rings[i].claimed, 0, 1))
+        {
+            rings[i].owner = self;
+            return &rings[i];
+        }
+    return 0;
+}
+
+bool writeEvent(s3eFile * file, const Event & event, int tid, bool first)
+{
+    char line[0x100];
+    unsigned long long begin = event.begin / 1000;
+    unsigned long long duration = event.end > event.begin ? event.end - event.begin : 0;
+    int size = snprintf(line, sizeof(line),
+                        "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%llu,\"dur\":%llu.%03u}",
+                        first ? "" : ",\n", event.name, tid, begin,
+                        duration / 1000, static_cast<unsigned>(duration % 1000));
+    if(size < 0 || size >= static_cast<int>(sizeof(line)))
+        return false;
+    return s3eFileWrite(line, size, 1, file) == 1;
+}
+
+}
+
+TraceScope::TraceScope(const char * name, bool callback)
+    : name_(name), begin_(s3eTimerGetUSTNanoseconds()), callback_(callback)
+{
+}
+
+TraceScope::~TraceScope()
+{
+    Ring * ring = currentRing(callback_);
+    if(!ring)
+        return;
+    Event & event = ring->events[ring->written & (ringSize - 1)];
+    event.name = name_;
+    event.begin = begin_;
+    event.end = s3eTimerGetUSTNanoseconds();
+    atomics.add(&ring->written, 1);
+}
+
+bool dumpTrace(const char * fname)
+{
+    s3eFile * file = s3eFileOpen(fname, "wb");
+    if(!file)
+        return false;
+
+    static const char header[] = "{\"traceEvents\":[\n";
+    static const char footer[] = "\n]}\n";
+    bool ok = s3eFileWrite(header, sizeof(header) - 1, 1, file) == 1;
+    bool first = true;
+    for(int i = 0; ok && i != maxThreads; ++i)
+    {
+        Ring & ring = rings[i];
+        if(!atomics.cas(&ring.claimed, 0, 0))
+            continue;
+        unsigned written = atomics.cas(&ring.written, 0, 0);
+        unsigned count = std::min(written, ringSize);
+        for(unsigned j = written - count; ok && j != written; ++j)
+        {
+            ok = writeEvent(file, ring.events[j & (ringSize - 1)], i, first);
+            first = false;
+        }
+    }
+    ok = ok && s3eFileWrite(footer, sizeof(footer) - 1, 1, file) == 1;
+    s3eFileClose(file);
+    return ok;
+}
+
+}
+
+#else
+
+namespace audio {
+
+bool dumpTrace(const char * fname)
+{
+    return false;
+}
+
+}
+
+#endif
@@ -1,13 +1,14 @@
 #include <limits>
+#include <math.h>
 
 #include <s3eFile.h>
 
 #include <IwDebug.h>
 
 #include <vorbis/vorbisfile.h>
-#include <speex/speex_resampler.h>
 
 #include "audio/Buffer.h"
+#include "audio/Resampler.h"
 
 #include "audio/Utils.h"
 
@@ -15,17 +16,24 @@ namespace audio {
 
 AtomicFunctions atomics;
 
-void resample(SpeexResamplerState * resampler, int16_t * buffer, size_t & filled, std::vector<int16_t> & out)
+namespace {
+
+// Float samples resampled at once before quantization.
+const size_t floatChunk = 0x400;
+
+}
+
+void resample(Resampler & resampler, int16_t * buffer, size_t & filled, std::vector<int16_t> & out)
 {
-    uint32_t inputRate, outputRate;
-    speex_resampler_get_rate(resampler, &inputRate, &outputRate);
+    uint32_t inputRate = resampler.inputRate();
+    uint32_t outputRate = resampler.outputRate();
 
     uint32_t inlen = filled;
     size_t oldSize = out.size();
     out.resize(oldSize + (static_cast<int64_t>(inlen) * outputRate / inputRate) + 1); 
     out.resize(out.capacity());
     uint32_t outlen = out.size() - oldSize;
-    speex_resampler_process_int(resampler, 0, buffer, &inlen, &out[oldSize], &outlen);
+    resampler.process(buffer, inlen, &out[oldSize], outlen);
     out.resize(oldSize + outlen);
 //    out.insert(out.end(), buffer, buffer + inlen);
     
@@ -33,6 +41,40 @@ void resample(SpeexResamplerState * resampler, int16_t * buffer, size_t & filled
     filled -= inlen;
 }
 
+void resample(Resampler & resampler, float * buffer, size_t & filled, int volume, std::vector<int16_t> & out)
+{
+    float resampled[floatChunk];
+    size_t consumed = 0;
+    for(;;)
+    {
+        uint32_t inlen = filled - consumed;
+        uint32_t outlen = floatChunk;
+        resampler.processFloat(buffer + consumed, inlen, resampled, outlen);
+        consumed += inlen;
+        if(outlen)
+        {
+            size_t oldSize = out.size();
+            out.resize(oldSize + outlen);
+            quantize(&out[oldSize], resampled, volume, outlen);
+        }
+        if(outlen < floatChunk)
+            break;
+    }
+
+    memmove(buffer, buffer + consumed, (filled - consumed) * sizeof(float));
+    filled -= consumed;
+}
+
+void quantize(int16_t * out, const float * inp, int volume, size_t samples)
+{
+    float gain = 0x8000 * (volume / 256.0f);
+    for(size_t i = 0; i != samples; ++i)
+    {
+        float v = floor(inp[i] * gain + 0.5f);
+        out[i] = static_cast<int16_t>(v < -0x8000 ? -0x8000 : (v > 0x7fff ? 0x7fff : v));
+    }
+}
+
 inline int combine(int a, int b)
 {
     return (a + b);
@@ -47,6 +89,11 @@ inline int clamp(int v, int min, int max)
     return v;
 }
 
+inline int absolute(int v)
+{
+    return v < 0 ? -v : v;
+}
+
 void mix(bool mix, int16_t * out, int16_t * inp, int volume, size_t samples)
 {
     if(!mix)
@@ -75,13 +122,74 @@ void mix(bool mix, int16_t * out, int16_t * inp, int volume, size_t samples)
     }
 }
 
+size_t mixResampled(int16_t * out, const int16_t * inp, size_t available, uint32_t & phase, uint32_t step,
+                    int volume, size_t samples, size_t & consumed)
+{
+    typedef std::numeric_limits<int16_t> limits;
+    int min = limits::min();
+    int max = limits::max();
+
+    uint64_t pos = phase;
+    uint64_t end = available > 1 ? static_cast<uint64_t>(available - 1) << 16 : 0;
+    size_t produced = 0;
+    for(; produced != samples && pos < end; ++produced, pos += step)
+    {
+        size_t idx = static_cast<size_t>(pos >> 16);
+        int frac = static_cast<int>(pos & 0xffff);
+        int a = inp[idx];
+        int v = (a + static_cast<int>((static_cast<int64_t>(inp[idx + 1] - a) * frac) >> 16)) * volume / 0x100;
+        out[produced] = clamp(combine(out[produced], v), min, max);
+    }
+
+    consumed = static_cast<size_t>(std::min<uint64_t>(pos >> 16, available));
+    phase = static_cast<uint32_t>(pos - (static_cast<uint64_t>(consumed) << 16));
+    return produced;
+}
+
+void mixPanned(int16_t * out, const int16_t * inp, int left, int right, size_t samples)
+{
+    typedef std::numeric_limits<int16_t> limits;
+    int min = limits::min();
+    int max = limits::max();
+    for(size_t i = 0; i != samples; ++i)
+    {
+        int v = inp[i];
+        out[i * 2] = clamp(combine(out[i * 2], v * left / 0x100), min, max);
+        out[i * 2 + 1] = clamp(combine(out[i * 2 + 1], v * right / 0x100), min, max);
+    }
+}
+
+void measure(const int16_t * data, size_t samples, int & peak, int64_t & squares)
+{
+    int localPeak = peak;
+    int64_t localSquares = 0;
+    for(size_t i = 0; i != samples; ++i)
+    {
+        int v = data[i];
+        localPeak = std::max(localPeak, absolute(v));
+        localSquares += v * v;
+    }
+    peak = std::min(localPeak, 0x7fff);
+    squares += localSquares;
+}
+
+int rms(int64_t squares, size_t samples)
+{
+    return samples ? static_cast<int>(sqrt(static_cast<double>(squares) / samples)) : 0;
+}
+
 Buffer loadFile(const char * fname)
+{
+    return loadFile(fname, defaultBufferAllocator());
+}
+
+Buffer loadFile(const char * fname, BufferAllocator & allocator)
 {
     s3eFile * file = s3eFileOpen(fname, "rb");
     if(file)
     {
         size_t size = s3eFileGetSize(file);
-        Buffer result(size);
+        Buffer result(size, allocator);
         s3eFileRead(result.data(), 1, size, file);
         s3eFileClose(file);
         return result;
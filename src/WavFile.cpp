@@ -0,0 +1,109 @@
+#include <algorithm>
+
+#include <s3eDebug.h>
+
+#include "audio/WavFile.h"
+
+namespace audio {
+
+namespace {
+
+const uint16_t formatPcm = 1;
+const uint16_t formatExtensible = 0xfffe;
+const size_t riffHeaderSize = 12;
+const size_t chunkHeaderSize = 8;
+const size_t fmtSize = 16;
+// Offset of subformat GUID in extensible fmt chunk, its first two bytes are the format.
+const size_t subformatOffset = 24;
+
+inline uint32_t read32(const unsigned char * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint16_t read16(const unsigned char * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+}
+
+WavFile::WavFile(const Buffer & buffer)
+    : rate_(0), channels_(0), frames_(0), pos_(0)
+{
+    if(!detect(buffer))
+        return;
+
+    const unsigned char * begin = reinterpret_cast<const unsigned char*>(buffer.data());
+    const unsigned char * end = begin + buffer.size();
+    const unsigned char * fmt = 0;
+    size_t fmtLength = 0;
+    for(const unsigned char * p = begin + riffHeaderSize; end - p >= static_cast<ptrdiff_t>(chunkHeaderSize);)
+    {
+        size_t length = read32(p + 4);
+        const unsigned char * body = p + chunkHeaderSize;
+        length = std::min<size_t>(length, end - body);
+        if(!memcmp(p, "fmt ", 4))
+        {
+            fmt = body;
+            fmtLength = length;
+        } else if(!memcmp(p, "data", 4) && fmt)
+        {
+            uint16_t format = read16(fmt);
+            if(format == formatExtensible && fmtLength >= subformatOffset + 2)
+                format = read16(fmt + subformatOffset);
+            int channels = read16(fmt + 2);
+            int bits = read16(fmt + 14);
+            if(fmtLength < fmtSize || format != formatPcm || bits != 16 || channels < 1 || channels > 2)
+            {
+                s3eDebugTracePrintf("audio::WavFile, unsupported format %d, %d bits, %d channels", format, bits, channels);
+                return;
+            }
+
+            rate_ = read32(fmt + 4);
+            channels_ = channels;
+            frames_ = length / (2 * channels);
+            data_ = buffer.slice(body - begin, frames_ * 2 * channels);
+            return;
+        }
+        p = body + length + (length & 1);
+    }
+    s3eDebugTracePrintf("audio::WavFile, no data chunk");
+}
+
+bool WavFile::detect(const Buffer & buffer)
+{
+    const char * data = buffer.data();
+    return buffer.size() >= riffHeaderSize && !memcmp(data, "RIFF", 4) && !memcmp(data + 8, "WAVE", 4);
+}
+
+long WavFile::read(void * out, size_t len)
+{
+    size_t frames = std::min(len / 2, frames_ - pos_);
+    const int16_t * inp = reinterpret_cast<const int16_t*>(data_.data()) + pos_ * channels_;
+    if(channels_ == 1)
+        memcpy(out, inp, frames * 2);
+    else
+    {
+        int16_t * output = static_cast<int16_t*>(out);
+        for(size_t i = 0; i != frames; ++i)
+            output[i] = static_cast<int16_t>((inp[i * 2] + inp[i * 2 + 1]) / 2);
+    }
+    pos_ += frames;
+    return static_cast<long>(frames * 2);
+}
+
+bool WavFile::seek(int64_t frame)
+{
+    if(frame < 0 || static_cast<uint64_t>(frame) > frames_)
+        return false;
+    pos_ = static_cast<size_t>(frame);
+    return true;
+}
+
+Buffer WavFile::pcm()
+{
+    return channels_ == 1 ? data_ : Buffer();
+}
+
+}